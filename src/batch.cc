@@ -0,0 +1,220 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "batch.h"
+#include "quantizer.h"
+#include "wave_writer.h"
+#include "work_queue.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sys/stat.h>
+#include <vector>
+
+using namespace std;
+
+// Number of samples generated at a time when rendering stems
+const int stem_block = 16384;
+
+// Output filename for track, e.g. "out/Kirby-03.wav" for "Kirby.nsf", with
+// an optional name after the track number
+static string output_path(const string &path, const string &out_dir,
+                          int track, const string &name = "") {
+  size_t slash = path.find_last_of("/\\");
+  string base = path.substr(slash == string::npos ? 0 : slash + 1);
+  size_t dot = base.rfind('.');
+  if (dot != string::npos && dot > 0)
+    base.resize(dot);
+
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), "-%02d", track + 1);
+  return out_dir + "/" + base + suffix + (name.empty() ? "" : "-" + name) +
+         ".wav";
+}
+
+// Voice name usable in a filename, e.g. "2-square-2" for voice 1, "Square 2"
+static string stem_name(int voice, const char *name) {
+  string out = to_string(voice + 1) + "-";
+  for (const char *p = name; *p; p++) {
+    if (isalnum((unsigned char)*p))
+      out += tolower((unsigned char)*p);
+    else if (out.back() != '-')
+      out += '-';
+  }
+  while (out.back() == '-')
+    out.pop_back();
+  return out;
+}
+
+Batch_Renderer::Batch_Renderer(int jobs) {
+  jobs_ = jobs;
+  dither_ = Quantizer::dither_none;
+}
+
+gme_err_t Batch_Renderer::render(const string &path, const string &out_dir,
+                                 callback_t done) {
+  if (mkdir(out_dir.c_str(), 0777) && errno != EEXIST)
+    return "Couldn't create output directory";
+
+  // Probe file once for track count and lengths
+  Renderer probe;
+  RETURN_ERR(probe.load_file(path));
+
+  vector<pair<long, int>> tracks;
+  for (int i = 0; i < probe.track_count(); i++)
+    tracks.push_back(make_pair(probe.track_length(i), i));
+  probe.unload();
+
+  // Longest first, so the last jobs to finish are the short ones
+  stable_sort(tracks.begin(), tracks.end(),
+              [](const pair<long, int> &a, const pair<long, int> &b) {
+                return a.first > b.first;
+              });
+
+  Work_Queue queue(min(jobs_ > 0 ? jobs_ : Work_Queue::core_count(),
+                       max((int)tracks.size(), 1)));
+
+  // Each worker loads the file once and reuses it for all its tracks
+  vector<unique_ptr<Renderer>> renderers(queue.worker_count());
+
+  mutex err_mutex;
+  gme_err_t first_err = 0;
+
+  for (auto &t : tracks) {
+    int track = t.second;
+    queue.push([&, track](int worker) {
+      gme_err_t err = 0;
+      string out = output_path(path, out_dir, track);
+
+      auto &renderer = renderers[worker];
+      if (!renderer) {
+        renderer.reset(new Renderer);
+        err = renderer->load_file(path);
+      }
+      if (!err)
+        err = renderer->start_track(track);
+
+      if (!err) {
+        Dsp_Chain dsp = dsp_;
+        dsp.init(renderer->sample_rate());
+        Wave_Writer writer;
+        writer.set_dither(dither_);
+        err = writer.open(out, renderer->sample_rate());
+        if (!err)
+          err = renderer->render(writer, &dsp);
+        if (!err)
+          err = writer.close();
+      }
+
+      if (err) {
+        lock_guard<mutex> lock(err_mutex);
+        if (!first_err)
+          first_err = err;
+      }
+      if (done)
+        done(*renderer, out, err);
+    });
+  }
+
+  queue.run();
+  return first_err;
+}
+
+gme_err_t Batch_Renderer::render_stems(const string &path, int track,
+                                       const string &out_dir,
+                                       callback_t done) {
+  if (mkdir(out_dir.c_str(), 0777) && errno != EEXIST)
+    return "Couldn't create output directory";
+
+  Renderer probe;
+  RETURN_ERR(probe.load_file(path));
+  if (track < 0 || track >= probe.track_count())
+    return "Invalid track";
+  int voice_count = gme_voice_count(probe.emu());
+  vector<string> names;
+  for (int v = 0; v < voice_count; v++)
+    names.push_back(stem_name(v, gme_voice_name(probe.emu(), v)));
+  probe.unload();
+
+  // Voice -1 is the full mix
+  Work_Queue queue(min(jobs_ > 0 ? jobs_ : Work_Queue::core_count(),
+                       voice_count + 1));
+  vector<unique_ptr<Renderer>> renderers(queue.worker_count());
+
+  mutex err_mutex;
+  gme_err_t first_err = 0;
+
+  for (int voice = -1; voice < voice_count; voice++) {
+    queue.push([&, voice](int worker) {
+      gme_err_t err = 0;
+      string out =
+          output_path(path, out_dir, track, voice < 0 ? "mix" : names[voice]);
+
+      auto &renderer = renderers[worker];
+      if (!renderer) {
+        renderer.reset(new Renderer);
+        err = renderer->load_file(path);
+      }
+      if (!err && !renderer->emu())
+        err = "No file loaded";
+
+      if (!err) {
+        // A solo voice goes silent far more often than the mix, so silence
+        // must not end it early: every stem plays for the full length. Set
+        // before starting, as starting skips leading silence unless ignored,
+        // and every stem must start at the same sample as the mix.
+        gme_ignore_silence(renderer->emu(), true);
+        gme_mute_voices(renderer->emu(), voice < 0 ? 0 : ~(1 << voice));
+        err = renderer->start_track(track);
+      }
+
+      if (!err) {
+        Dsp_Chain dsp = dsp_;
+        dsp.init(renderer->sample_rate());
+        Wave_Writer writer;
+        writer.set_dither(dither_);
+        err = writer.open(out, renderer->sample_rate());
+
+        float buf[stem_block];
+        while (!err && renderer->tell() < renderer->track_samples()) {
+          long count = min(renderer->track_samples() - renderer->tell(),
+                           (long)stem_block);
+          err = renderer->play(count, buf);
+          if (!err) {
+            dsp.process(buf, count);
+            err = writer.write(buf, count);
+          }
+        }
+        if (!err)
+          err = writer.close();
+      }
+
+      if (err) {
+        lock_guard<mutex> lock(err_mutex);
+        if (!first_err)
+          first_err = err;
+      }
+      if (done)
+        done(*renderer, out, err);
+    });
+  }
+
+  queue.run();
+  return first_err;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "dsp_chain.h"
+#include "renderer.h"
+#include <functional>
+#include <string>
+
+// Renders every track of a file into its own WAV file, with one emulator
+// instance per worker thread so all tracks are rendered at the same time.
+class Batch_Renderer {
+public:
+  // Called from worker threads each time a track is finished, with the
+  // renderer used, the output path and the error (NULL on success).
+  typedef std::function<void(const Renderer &, const std::string &,
+                             gme_err_t)>
+      callback_t;
+
+  // Use given number of worker threads, or one per core if 0.
+  explicit Batch_Renderer(int jobs = 0);
+
+  // Post-process every track with its own copy of dsp
+  void set_dsp(const Dsp_Chain &dsp) { dsp_ = dsp; }
+
+  // Dither used when writing files (see Quantizer)
+  void set_dither(int mode) { dither_ = mode; }
+
+  // Render all tracks of file into out_dir, longest tracks first. Output
+  // files are named after the input file and track number. Returns the
+  // first error found, if any.
+  gme_err_t render(const std::string &path, const std::string &out_dir,
+                   callback_t done = nullptr);
+
+  // Render each voice of track on its own into out_dir, next to the full
+  // mix, with one solo-voice emulator per voice. Every file has the length
+  // of the mix, so stems stay sample-aligned with it and with each other.
+  gme_err_t render_stems(const std::string &path, int track,
+                         const std::string &out_dir,
+                         callback_t done = nullptr);
+
+private:
+  int jobs_;
+  Dsp_Chain dsp_;
+  int dither_;
+};
+
+#endif // __BATCH_H__
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bench.h"
+#include "json.h"
+#include "renderer.h"
+#include "resampler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+using namespace std;
+
+// Number of samples rendered per call, same as the offline renderer
+const int bench_block = 16384;
+
+Benchmark::Benchmark() {
+  duration_ = 30.0;
+  rates_ = {44100};
+  tempos_ = {1.0};
+  accuracy_ = {false, true};
+  resample_rate_ = 0;
+}
+
+gme_err_t Benchmark::run(const string &path) {
+  results_.clear();
+  resample_results_.clear();
+
+  for (long rate : rates_) {
+    Renderer renderer;
+    RETURN_ERR(renderer.load_file(path, rate));
+
+    vector<int> tracks = tracks_;
+    if (tracks.empty())
+      for (int i = 0; i < renderer.track_count(); i++)
+        tracks.push_back(i);
+
+    for (int track : tracks) {
+      for (bool accuracy : accuracy_) {
+        for (double tempo : tempos_) {
+          gme_enable_accuracy(renderer.emu(), accuracy);
+          gme_set_tempo(renderer.emu(), tempo);
+          gme_ignore_silence(renderer.emu(), true);
+          RETURN_ERR(renderer.start_track(track, false));
+
+          long samples = (long)(duration_ * rate) * 2;
+          sample_t buf[bench_block];
+
+          auto start = chrono::steady_clock::now();
+          for (long n = 0; n < samples; n += bench_block)
+            RETURN_ERR(renderer.play(min(samples - n, (long)bench_block), buf));
+          chrono::duration<double> elapsed =
+              chrono::steady_clock::now() - start;
+
+          Result r;
+          r.track = track;
+          r.accuracy = accuracy;
+          r.sample_rate = rate;
+          r.tempo = tempo;
+          r.frames = renderer.tell() / 2;
+          r.elapsed = elapsed.count();
+          results_.push_back(r);
+        }
+      }
+    }
+
+    if (resample_rate_ > 0 && resample_rate_ != rate && !tracks.empty())
+      RETURN_ERR(run_resampler(renderer, tracks[0]));
+  }
+
+  return 0;
+}
+
+// Render duration of track first, so only the conversion is timed
+gme_err_t Benchmark::run_resampler(Renderer &renderer, int track) {
+  gme_enable_accuracy(renderer.emu(), false);
+  gme_set_tempo(renderer.emu(), 1.0);
+  gme_ignore_silence(renderer.emu(), true);
+  RETURN_ERR(renderer.start_track(track, false));
+
+  long rate = renderer.sample_rate();
+  // The player resamples float audio
+  vector<float> in((long)(duration_ * rate) * 2);
+  for (size_t n = 0; n < in.size(); n += bench_block)
+    RETURN_ERR(
+        renderer.play(min(in.size() - n, (size_t)bench_block), &in[n]));
+
+  for (int quality : qualities_) {
+    Resampler resampler;
+    RETURN_ERR(resampler.init(rate, resample_rate_, quality, bench_block));
+    vector<float> out(resampler.max_output(bench_block));
+
+    long frames = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t n = 0; n < in.size(); n += bench_block) {
+      int count = min(in.size() - n, (size_t)bench_block);
+      frames += resampler.process(&in[n], count, out.data(), out.size()) / 2;
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    Resample_Result r;
+    r.quality = quality;
+    r.in_rate = rate;
+    r.out_rate = resample_rate_;
+    r.frames = frames;
+    r.elapsed = elapsed.count();
+    resample_results_.push_back(r);
+  }
+  return 0;
+}
+
+// Quotient as a JSON number, or null if there is nothing to divide by
+static string json_ratio(double num, double den, const char *format) {
+  if (!(den > 0))
+    return "null";
+  char buf[64];
+  snprintf(buf, sizeof(buf), format, num / den);
+  return buf;
+}
+
+string Benchmark::to_json(const string &path) const {
+  string out = "{\n  \"file\": " + json_string(path) + ",\n";
+
+  char buf[512];
+  snprintf(buf, sizeof(buf), "  \"duration\": %g,\n  \"results\": [", duration_);
+  out += buf;
+
+  long total_frames = 0;
+  double total_elapsed = 0.0, total_emulated = 0.0;
+
+  for (size_t i = 0; i < results_.size(); i++) {
+    const Result &r = results_[i];
+    double emulated = (double)r.frames / r.sample_rate;
+    snprintf(buf, sizeof(buf),
+             "%s\n    {\"track\": %d, \"accuracy\": %s, \"sample_rate\": %ld, "
+             "\"tempo\": %g, \"frames\": %ld, \"elapsed\": %.6f, "
+             "\"frames_per_sec\": %s, \"realtime\": %s, "
+             "\"ns_per_frame\": %s}",
+             i ? "," : "", r.track + 1, r.accuracy ? "true" : "false",
+             r.sample_rate, r.tempo, r.frames, r.elapsed,
+             json_ratio(r.frames, r.elapsed, "%.0f").c_str(),
+             json_ratio(emulated, r.elapsed, "%.2f").c_str(),
+             json_ratio(r.elapsed * 1e9, r.frames, "%.2f").c_str());
+    out += buf;
+
+    total_frames += r.frames;
+    total_elapsed += r.elapsed;
+    total_emulated += emulated;
+  }
+
+  out += "\n  ],\n  \"resampling\": [";
+  for (size_t i = 0; i < resample_results_.size(); i++) {
+    const Resample_Result &r = resample_results_[i];
+    snprintf(buf, sizeof(buf),
+             "%s\n    {\"quality\": %d, \"simd\": \"%s\", \"from\": %ld, "
+             "\"to\": %ld, \"frames\": %ld, \"elapsed\": %.6f, "
+             "\"frames_per_sec\": %s, \"realtime\": %s, "
+             "\"ns_per_frame\": %s}",
+             i ? "," : "", r.quality, Resampler::simd_name(), r.in_rate,
+             r.out_rate, r.frames, r.elapsed,
+             json_ratio(r.frames, r.elapsed, "%.0f").c_str(),
+             json_ratio((double)r.frames / r.out_rate, r.elapsed, "%.2f")
+                 .c_str(),
+             json_ratio(r.elapsed * 1e9, r.frames, "%.2f").c_str());
+    out += buf;
+  }
+
+  snprintf(buf, sizeof(buf),
+           "\n  ],\n  \"total\": {\"frames\": %ld, \"elapsed\": %.6f, "
+           "\"frames_per_sec\": %s, \"realtime\": %s}\n}\n",
+           total_frames, total_elapsed,
+           json_ratio(total_frames, total_elapsed, "%.0f").c_str(),
+           json_ratio(total_emulated, total_elapsed, "%.2f").c_str());
+  out += buf;
+  return out;
+}
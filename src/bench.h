@@ -0,0 +1,94 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include "common.h"
+#include <string>
+#include <vector>
+
+class Renderer;
+
+// Measures emulation throughput: renders tracks for a fixed emulated
+// duration with no audio device, under each combination of settings.
+class Benchmark {
+public:
+  // Measurement for one track under one combination of settings
+  struct Result {
+    int track;
+    bool accuracy;
+    long sample_rate;
+    double tempo;
+    long frames;    // stereo sample frames rendered
+    double elapsed; // wall time in seconds
+  };
+
+  // Measurement of the resampler at one quality level
+  struct Resample_Result {
+    int quality;
+    long in_rate, out_rate;
+    long frames;    // stereo sample frames converted
+    double elapsed; // wall time in seconds
+  };
+
+  Benchmark();
+
+  // Emulated seconds rendered per measurement
+  void set_duration(double seconds) { duration_ = seconds; }
+
+  // Tracks to measure (numbered from 0), or all if empty
+  void set_tracks(const std::vector<int> &tracks) { tracks_ = tracks; }
+
+  // Settings to combine
+  void set_sample_rates(const std::vector<long> &rates) { rates_ = rates; }
+  void set_tempos(const std::vector<double> &tempos) { tempos_ = tempos; }
+  void set_accuracy(const std::vector<bool> &modes) { accuracy_ = modes; }
+
+  // Also measure converting audio rendered at each sample rate to out_rate,
+  // at each resampler quality. 0 disables it.
+  void set_resampling(long out_rate, const std::vector<int> &qualities) {
+    resample_rate_ = out_rate;
+    qualities_ = qualities;
+  }
+
+  // Run all measurements on file, one at a time
+  gme_err_t run(const std::string &path);
+
+  // Results of last run
+  const std::vector<Result> &results() const { return results_; }
+  const std::vector<Resample_Result> &resample_results() const {
+    return resample_results_;
+  }
+
+  // Results of last run as a JSON document
+  std::string to_json(const std::string &path) const;
+
+private:
+  double duration_;
+  std::vector<int> tracks_;
+  std::vector<long> rates_;
+  std::vector<double> tempos_;
+  std::vector<bool> accuracy_;
+  long resample_rate_;
+  std::vector<int> qualities_;
+  std::vector<Result> results_;
+  std::vector<Resample_Result> resample_results_;
+
+  gme_err_t run_resampler(Renderer &renderer, int track);
+};
+
+#endif // __BENCH_H__
@@ -0,0 +1,32 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __COMMON_H__
+#define __COMMON_H__
+
+#include "gme/gme.h"
+
+typedef short sample_t;
+
+// Return error string from expression, if any
+#define RETURN_ERR(expr)                                                       \
+  do {                                                                         \
+    gme_err_t err_ = (expr);                                                   \
+    if (err_)                                                                  \
+      return err_;                                                             \
+  } while (0)
+
+#endif // __COMMON_H__
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dsp_chain.h"
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// Limiter starts compressing at -2 dBFS, and never quite reaches full scale
+const float limit_threshold = 0.794f;
+
+Dsp_Chain::Dsp_Chain() {
+  sample_rate_ = 44100;
+  gain_ = 1.0f;
+  limiter_ = false;
+  dc_removal_ = false;
+  console_filter_ = filter_none;
+}
+
+void Dsp_Chain::init(long sample_rate) {
+  sample_rate_ = sample_rate;
+  update_filters();
+}
+
+void Dsp_Chain::set_gain(double db) { gain_ = pow(10.0, db / 20); }
+
+void Dsp_Chain::enable_dc_removal(bool b) {
+  dc_removal_ = b;
+  update_filters();
+}
+
+void Dsp_Chain::set_console_filter(int filter) {
+  console_filter_ = filter;
+  update_filters();
+}
+
+bool Dsp_Chain::active() const {
+  return gain_ != 1.0f || limiter_ || !filters_.empty();
+}
+
+void Dsp_Chain::reset() {
+  for (auto &f : filters_)
+    f.x1[0] = f.x1[1] = f.y1[0] = f.y1[1] = 0;
+}
+
+// RC filters, as in the console's output circuit
+static void add_high_pass(vector<float> &coeffs, double hz, long rate) {
+  double rc = 1 / (2 * M_PI * hz), dt = 1.0 / rate;
+  double a = rc / (rc + dt);
+  coeffs.insert(coeffs.end(), {(float)a, (float)-a, (float)a});
+}
+
+static void add_low_pass(vector<float> &coeffs, double hz, long rate) {
+  // Nothing to cut below Nyquist
+  if (hz >= rate * 0.45)
+    return;
+  double rc = 1 / (2 * M_PI * hz), dt = 1.0 / rate;
+  double a = dt / (rc + dt);
+  coeffs.insert(coeffs.end(), {(float)a, 0.0f, (float)(1 - a)});
+}
+
+void Dsp_Chain::update_filters() {
+  vector<float> coeffs;
+  if (dc_removal_)
+    add_high_pass(coeffs, 5, sample_rate_);
+  if (console_filter_ == filter_nes) {
+    add_high_pass(coeffs, 90, sample_rate_);
+    add_high_pass(coeffs, 440, sample_rate_);
+    add_low_pass(coeffs, 14000, sample_rate_);
+  } else if (console_filter_ == filter_famicom) {
+    add_high_pass(coeffs, 37, sample_rate_);
+    add_low_pass(coeffs, 14000, sample_rate_);
+  }
+
+  filters_.clear();
+  for (size_t i = 0; i < coeffs.size(); i += 3) {
+    Filter f;
+    f.b0 = coeffs[i];
+    f.b1 = coeffs[i + 1];
+    f.a1 = coeffs[i + 2];
+    filters_.push_back(f);
+  }
+  reset();
+}
+
+static void apply_gain(float *io, int count, float gain) {
+  int i = 0;
+#ifdef __SSE2__
+  const __m128 g = _mm_set1_ps(gain);
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_ps(io + i, _mm_mul_ps(_mm_loadu_ps(io + i), g));
+#endif
+  for (; i < count; i++)
+    io[i] *= gain;
+}
+
+// Above the threshold, y = t + (1 - t) * u / (1 + u) with
+// u = (|x| - t) / (1 - t): continuous slope at t, approaching full scale
+static void apply_limiter(float *io, int count) {
+  const float t = limit_threshold, range = 1 - t;
+  int i = 0;
+#ifdef __SSE2__
+  const __m128 sign_mask = _mm_set1_ps(-0.0f);
+  const __m128 vt = _mm_set1_ps(t), vrange = _mm_set1_ps(range);
+  const __m128 one = _mm_set1_ps(1.0f);
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_loadu_ps(io + i);
+    __m128 sign = _mm_and_ps(x, sign_mask);
+    __m128 mag = _mm_andnot_ps(sign_mask, x);
+    __m128 u = _mm_div_ps(_mm_sub_ps(mag, vt), vrange);
+    __m128 limited =
+        _mm_add_ps(vt, _mm_mul_ps(vrange, _mm_div_ps(u, _mm_add_ps(one, u))));
+    __m128 over = _mm_cmpgt_ps(mag, vt);
+    mag = _mm_or_ps(_mm_and_ps(over, limited), _mm_andnot_ps(over, mag));
+    _mm_storeu_ps(io + i, _mm_or_ps(mag, sign));
+  }
+#endif
+  for (; i < count; i++) {
+    float mag = fabsf(io[i]);
+    if (mag > t) {
+      float u = (mag - t) / range;
+      io[i] = copysignf(t + range * u / (1 + u), io[i]);
+    }
+  }
+}
+
+void Dsp_Chain::process(float *io, int count) {
+  if (!active())
+    return;
+
+  // Recursive, so one frame at a time with both channels side by side
+  for (auto &f : filters_) {
+    for (int i = 0; i < count; i += 2) {
+      for (int c = 0; c < 2; c++) {
+        float x = io[i + c];
+        float y = f.b0 * x + f.b1 * f.x1[c] + f.a1 * f.y1[c];
+        f.x1[c] = x;
+        f.y1[c] = y;
+        io[i + c] = y;
+      }
+    }
+
+    // Let decaying state reach zero instead of going denormal
+    for (int c = 0; c < 2; c++)
+      if (fabsf(f.y1[c]) < 1e-20f)
+        f.y1[c] = 0;
+  }
+
+  if (gain_ != 1.0f)
+    apply_gain(io, count, gain_);
+  if (limiter_)
+    apply_limiter(io, count);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DSP_CHAIN_H__
+#define __DSP_CHAIN_H__
+
+#include "common.h"
+#include <vector>
+
+// Post-processing of rendered stereo audio: DC removal, the output filters
+// of the console, gain and a soft limiter, in that order. Each stage can be
+// switched on its own. Works in float only: output is quantized where it is
+// written. process() never allocates.
+class Dsp_Chain {
+public:
+  // Analog output filters of the console
+  enum { filter_none, filter_nes, filter_famicom };
+
+  Dsp_Chain();
+
+  // Set sample rate of the audio to process, and reset filter state
+  void init(long sample_rate);
+
+  // Gain in decibels, 0 for none
+  void set_gain(double db);
+
+  // Softly compress peaks above -2 dBFS instead of clipping them
+  void enable_limiter(bool b) { limiter_ = b; }
+
+  // Remove DC offset with a 5 Hz high-pass filter
+  void enable_dc_removal(bool b);
+
+  // Emulate output filters: NES (high-pass at 90 and 440 Hz, low-pass at
+  // 14 kHz) or Famicom (high-pass at 37 Hz, low-pass at 14 kHz)
+  void set_console_filter(int filter);
+
+  // True if any stage is on
+  bool active() const;
+
+  // Clear filter state, e.g. after seeking
+  void reset();
+
+  // Process count samples (count / 2 stereo frames) in place
+  void process(float *io, int count);
+
+private:
+  // First order IIR filter: y = b0 * x + b1 * x1 + a1 * y1
+  struct Filter {
+    float b0, b1, a1;
+    float x1[2], y1[2];
+  };
+
+  long sample_rate_;
+  float gain_;
+  bool limiter_;
+  bool dc_removal_;
+  int console_filter_;
+  std::vector<Filter> filters_;
+
+  void update_filters();
+};
+
+#endif // __DSP_CHAIN_H__
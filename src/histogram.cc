@@ -0,0 +1,126 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "histogram.h"
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+const int Histogram::sub_buckets;
+const int Histogram::bucket_count;
+
+Histogram::Histogram() { clear(); }
+
+void Histogram::clear() {
+  for (auto &b : buckets_)
+    b.store(0, memory_order_relaxed);
+  count_.store(0, memory_order_relaxed);
+  sum_.store(0, memory_order_relaxed);
+  max_.store(0, memory_order_relaxed);
+}
+
+int Histogram::bucket_of(uint64_t ns) {
+  if (ns < sub_buckets)
+    return ns;
+
+  // Position of highest bit, plus the next two bits below it
+  int bits = 63 - __builtin_clzll(ns);
+  int sub = (ns >> (bits - 2)) & (sub_buckets - 1);
+  int b = (bits - 1) * sub_buckets + sub;
+  return b < bucket_count ? b : bucket_count - 1;
+}
+
+uint64_t Histogram::bucket_limit(int bucket) {
+  if (bucket < sub_buckets)
+    return bucket + 1;
+
+  int bits = bucket / sub_buckets + 1;
+  int sub = bucket % sub_buckets;
+  return (uint64_t)(sub_buckets + sub + 1) << (bits - 2);
+}
+
+void Histogram::record(uint64_t ns) {
+  buckets_[bucket_of(ns)].fetch_add(1, memory_order_relaxed);
+  count_.fetch_add(1, memory_order_relaxed);
+  sum_.fetch_add(ns, memory_order_relaxed);
+
+  uint64_t m = max_.load(memory_order_relaxed);
+  while (ns > m && !max_.compare_exchange_weak(m, ns, memory_order_relaxed)) {
+  }
+}
+
+double Histogram::mean() const {
+  uint64_t n = count();
+  return n ? (double)sum_.load(memory_order_relaxed) / n : 0.0;
+}
+
+uint64_t Histogram::percentile(double p) const {
+  uint64_t n = count();
+  if (!n)
+    return 0;
+
+  uint64_t target = (uint64_t)(p * n);
+  uint64_t seen = 0;
+  for (int b = 0; b < bucket_count; b++) {
+    seen += buckets_[b].load(memory_order_relaxed);
+    if (seen > target)
+      return min(bucket_limit(b), max());
+  }
+  return max();
+}
+
+string format_ns(double ns) {
+  char buf[32];
+  if (ns < 1e3)
+    snprintf(buf, sizeof(buf), "%.0fns", ns);
+  else if (ns < 1e6)
+    snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+  else if (ns < 1e9)
+    snprintf(buf, sizeof(buf), "%.2fms", ns / 1e6);
+  else
+    snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+  return buf;
+}
+
+string Histogram::summary() const {
+  char buf[160];
+  snprintf(buf, sizeof(buf), "n=%llu mean=%s p50=%s p99=%s max=%s",
+           (unsigned long long)count(), format_ns(mean()).c_str(),
+           format_ns(percentile(0.5)).c_str(),
+           format_ns(percentile(0.99)).c_str(), format_ns(max()).c_str());
+  return buf;
+}
+
+string Histogram::dump() const {
+  uint64_t most = 0;
+  for (auto &b : buckets_)
+    most = std::max(most, b.load(memory_order_relaxed));
+
+  string out;
+  for (int b = 0; b < bucket_count; b++) {
+    uint64_t n = buckets_[b].load(memory_order_relaxed);
+    if (!n)
+      continue;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "  < %9s %10llu ",
+             format_ns(bucket_limit(b)).c_str(), (unsigned long long)n);
+    out += buf;
+    out += string(1 + n * 39 / most, '#');
+    out += "\n";
+  }
+  return out;
+}
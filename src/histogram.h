@@ -0,0 +1,66 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Lock-free histogram of durations in nanoseconds, safe to record into from
+// the audio thread. Buckets grow exponentially, with four buckets per power
+// of two, so percentiles are accurate to within about 20%.
+class Histogram {
+public:
+  Histogram();
+
+  // Record one value. Never blocks or allocates.
+  void record(uint64_t ns);
+
+  // Forget all values
+  void clear();
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+  double mean() const;
+
+  // Approximate value below which fraction p (0.0 to 1.0) of values fall
+  uint64_t percentile(double p) const;
+
+  // One line summary, e.g. "n=100 mean=1.2ms p50=1.1ms p99=2.0ms max=3.1ms"
+  std::string summary() const;
+
+  // Multi-line dump of non-empty buckets, with a bar for each
+  std::string dump() const;
+
+private:
+  static const int sub_buckets = 4;
+  static const int bucket_count = 64 * sub_buckets;
+
+  std::atomic<uint64_t> buckets_[bucket_count];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+
+  static int bucket_of(uint64_t ns);
+  static uint64_t bucket_limit(int bucket);
+};
+
+// Format nanoseconds with a suitable unit, e.g. "850ns", "1.25ms"
+std::string format_ns(double ns);
+
+#endif // __HISTOGRAM_H__
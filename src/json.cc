@@ -0,0 +1,84 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "json.h"
+#include <cstdio>
+
+using namespace std;
+
+// Length of the valid UTF-8 sequence starting at s, or 0 if there is none.
+// Overlong forms, surrogates and code points past U+10FFFF are invalid.
+static int utf8_length(const unsigned char *s) {
+  int n;
+  unsigned min;
+  unsigned cp;
+  if (s[0] < 0x80)
+    return 1;
+  if ((s[0] & 0xe0) == 0xc0) {
+    n = 2, min = 0x80, cp = s[0] & 0x1f;
+  } else if ((s[0] & 0xf0) == 0xe0) {
+    n = 3, min = 0x800, cp = s[0] & 0x0f;
+  } else if ((s[0] & 0xf8) == 0xf0) {
+    n = 4, min = 0x10000, cp = s[0] & 0x07;
+  } else {
+    return 0;
+  }
+  for (int i = 1; i < n; i++) {
+    if ((s[i] & 0xc0) != 0x80)
+      return 0;
+    cp = cp << 6 | (s[i] & 0x3f);
+  }
+  if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+    return 0;
+  return n;
+}
+
+string json_string(const char *s) {
+  string out = "\"";
+  for (; s && *s; s++) {
+    unsigned char c = *s;
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      // Tags are often Latin-1 or Shift-JIS rather than UTF-8, so bytes
+      // that aren't valid UTF-8 are taken as Latin-1
+      int n = c < 0x80 ? 1 : utf8_length((const unsigned char *)s);
+      if (c < 0x20 || n == 0) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out += buf;
+      } else {
+        out.append(s, n);
+        s += n - 1;
+      }
+    }
+  }
+  return out + "\"";
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __JSON_H__
+#define __JSON_H__
+
+#include <string>
+
+// Quote and escape string as a JSON string literal. NULL becomes "". Bytes
+// that are not valid UTF-8 are escaped as Latin-1 characters.
+std::string json_string(const char *s);
+
+inline std::string json_string(const std::string &s) {
+  return json_string(s.c_str());
+}
+
+#endif // __JSON_H__
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "length_analyzer.h"
+#include "loop_detector.h"
+#include "track_cache.h"
+#include "work_queue.h"
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+
+using namespace std;
+
+// Number of samples emulated at a time
+const int analyze_block = 8192;
+
+Length_Analyzer::Length_Analyzer() {
+  sample_rate_ = 22050;
+  max_length_ = 15 * 60 * 1000;
+  silence_length_ = 3000;
+  silence_threshold_ = 16;
+}
+
+void Length_Analyzer::set_silence(long msec, int threshold) {
+  silence_length_ = msec;
+  silence_threshold_ = threshold;
+}
+
+gme_err_t Length_Analyzer::analyze(Renderer &r, int track, Result &result) {
+  result.track = track;
+  result.length = -1;
+  result.intro_length = -1;
+  result.loop_length = -1;
+
+  if (!r.emu())
+    return "No file loaded";
+
+  // Silence is handled here, with our own thresholds. Set before starting,
+  // which otherwise skips leading silence, so lengths include it whether or
+  // not the renderer was used before.
+  gme_ignore_silence(r.emu(), true);
+  RETURN_ERR(r.start_track(track, false));
+
+  const long rate = r.sample_rate() * 2;
+  const long max_samples = max_length_ * rate / 1000;
+  const long silence_samples = silence_length_ * rate / 1000;
+
+  Loop_Detector loop(r.sample_rate());
+
+  sample_t buf[analyze_block];
+  long last_sound = 0;
+
+  while (r.tell() < max_samples) {
+    long pos = r.tell();
+    RETURN_ERR(r.play(analyze_block, buf));
+
+    if (loop.feed(buf, analyze_block)) {
+      result.intro_length = loop.intro_msec();
+      result.loop_length = loop.loop_msec();
+      break;
+    }
+
+    for (int i = analyze_block - 1; i >= 0; i--) {
+      if (abs(buf[i]) > silence_threshold_) {
+        last_sound = pos + i + 1;
+        break;
+      }
+    }
+
+    if (r.track_ended() || r.tell() - last_sound >= silence_samples) {
+      result.length = last_sound * 1000 / rate;
+      break;
+    }
+  }
+
+  return 0;
+}
+
+gme_err_t Length_Analyzer::analyze_file(const string &path, int jobs,
+                                        vector<Result> &results,
+                                        Track_Cache *cache,
+                                        callback_t done) {
+  Renderer probe;
+  RETURN_ERR(probe.load_file(path, sample_rate_));
+  int count = probe.track_count();
+  probe.unload();
+
+  results.assign(count, Result());
+
+  Work_Queue queue(min(jobs > 0 ? jobs : Work_Queue::core_count(),
+                       max(count, 1)));
+  vector<unique_ptr<Renderer>> renderers(queue.worker_count());
+
+  mutex err_mutex;
+  gme_err_t first_err = 0;
+
+  for (int i = 0; i < count; i++) {
+    queue.push([&, i](int worker) {
+      Result &result = results[i];
+      result.track = i;
+      result.length = result.intro_length = result.loop_length = -1;
+
+      gme_err_t err = 0;
+      auto &renderer = renderers[worker];
+      if (!renderer) {
+        renderer.reset(new Renderer);
+        err = renderer->load_file(path, sample_rate_);
+      }
+      if (!err)
+        err = analyze(*renderer, i, result);
+
+      if (err) {
+        lock_guard<mutex> lock(err_mutex);
+        if (!first_err)
+          first_err = err;
+      } else if (cache) {
+        // A track that never went silent loops, so it has to fade out
+        double ends = result.length >= 0;
+        cache->put(path, i, {(double)result.length, ends,
+                             (double)result.intro_length,
+                             (double)result.loop_length});
+      }
+
+      if (done)
+        done(result, err);
+    });
+  }
+
+  queue.run();
+
+  if (cache && !first_err)
+    RETURN_ERR(cache->save());
+  return first_err;
+}
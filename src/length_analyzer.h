@@ -0,0 +1,77 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __LENGTH_ANALYZER_H__
+#define __LENGTH_ANALYZER_H__
+
+#include "renderer.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+class Track_Cache;
+
+// Finds out how long tracks really play by emulating them as fast as
+// possible, with no audio output, until they end, go silent or are found to
+// loop.
+class Length_Analyzer {
+public:
+  // Result for one track
+  struct Result {
+    int track;
+    // Milliseconds until the end of the last sound, or -1 if the track kept
+    // playing up to the maximum length (most likely it loops)
+    long length;
+    // Intro and loop length in milliseconds if the track loops, or -1
+    long intro_length;
+    long loop_length;
+  };
+
+  // Called from worker threads as each track is analyzed
+  typedef std::function<void(const Result &, gme_err_t)> callback_t;
+
+  Length_Analyzer();
+
+  // Sample rate used for emulation. Lower rates are cheaper and work just
+  // as well for finding silence.
+  void set_sample_rate(long rate) { sample_rate_ = rate; }
+
+  // Give up on tracks longer than msec milliseconds
+  void set_max_length(long msec) { max_length_ = msec; }
+
+  // Consider the track ended after msec milliseconds with no sample louder
+  // than threshold
+  void set_silence(long msec, int threshold);
+
+  // Analyze track on a renderer that already has the file loaded
+  gme_err_t analyze(Renderer &, int track, Result &);
+
+  // Analyze all tracks of file, in parallel with given number of worker
+  // threads (or one per core if 0). Results are stored in cache, if any, as
+  // length, whether it ends by itself, intro length and loop length.
+  gme_err_t analyze_file(const std::string &path, int jobs,
+                         std::vector<Result> &results,
+                         Track_Cache *cache = nullptr,
+                         callback_t done = nullptr);
+
+private:
+  long sample_rate_;
+  long max_length_;
+  long silence_length_;
+  int silence_threshold_;
+};
+
+#endif // __LENGTH_ANALYZER_H__
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "loop_detector.h"
+#include <algorithm>
+
+using namespace std;
+
+// Multiplier of the polynomial rolling hash (mod 2^64)
+const uint64_t hash_base = 1000003;
+
+// Don't keep more than this many unverified candidates around
+const size_t max_pending = 256;
+
+// Output kept to find exactly where loops begin, in milliseconds
+const long recent_msec = 2 * 60 * 1000;
+
+Loop_Detector::Loop_Detector(long sample_rate) {
+  sample_rate_ = sample_rate;
+  min_loop_ = sample_rate;
+  verify_ = 30 * sample_rate;
+  block_size_ = 2048;
+  reset();
+}
+
+void Loop_Detector::set_min_loop(long msec) {
+  min_loop_ = msec * sample_rate_ / 1000;
+}
+
+void Loop_Detector::set_verify_length(long msec) {
+  verify_ = msec * sample_rate_ / 1000;
+}
+
+void Loop_Detector::set_block_size(int frames) {
+  block_size_ = frames;
+  reset();
+}
+
+void Loop_Detector::reset() {
+  // Enough for the loop and the blocks around it
+  long size = 1;
+  while (size < recent_msec * sample_rate_ / 1000 + 2 * block_size_)
+    size *= 2;
+  recent_.assign(size, 0);
+  recent_mask_ = size - 1;
+  count_ = 0;
+  block_hashes_.clear();
+  blocks_.clear();
+  pending_.clear();
+  hash_ = 0;
+  base_pow_ = 1;
+  for (int i = 0; i < block_size_; i++)
+    base_pow_ *= hash_base;
+  intro_ = 0;
+  loop_ = 0;
+}
+
+bool Loop_Detector::feed(const sample_t *in, int count) {
+  for (int i = 0; i + 1 < count && !found(); i += 2)
+    add_frame((uint16_t)in[i] << 16 | (uint16_t)in[i + 1]);
+  return found();
+}
+
+void Loop_Detector::add_frame(uint32_t value) {
+  recent_[count_ & recent_mask_] = value;
+  long n = ++count_;
+
+  // Roll hash of the last block_size frames
+  hash_ = hash_ * hash_base + value + 1;
+  if (n > block_size_)
+    hash_ -= ((uint64_t)frame(n - 1 - block_size_) + 1) * base_pow_;
+  if (n < block_size_)
+    return;
+
+  long start = n - block_size_;
+
+  // Compare with the block one loop earlier, for each candidate that has
+  // verified everything up to here
+  for (auto &c : pending_) {
+    if (!c.failed && start - c.loop == c.start + c.checked) {
+      if (block_hashes_[(c.start + c.checked) / block_size_] == hash_)
+        c.checked += block_size_;
+      else
+        c.failed = true;
+    }
+  }
+
+  // Look for an earlier block with the same content, far enough back
+  long best = -1;
+  auto range = blocks_.equal_range(hash_);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (start - it->second >= min_loop_ && it->second > best)
+      best = it->second;
+  }
+  if (best >= 0 && pending_.size() < max_pending) {
+    bool dup = false;
+    for (auto &c : pending_)
+      dup |= c.loop == start - best;
+    if (!dup) {
+      long loop = start - best;
+      pending_.push_back({best, loop, find_intro(best, loop), block_size_,
+                          false});
+    }
+  }
+
+  // Index every complete block, except constant ones (silence), which
+  // would match anything
+  if (start % block_size_ == 0) {
+    block_hashes_.push_back(hash_);
+    bool constant = true;
+    for (long i = start + 1; i < n && constant; i++)
+      constant = frame(i) == frame(start);
+    if (!constant)
+      blocks_.insert(make_pair(hash_, start));
+  }
+
+  check_pending();
+}
+
+// Walk back from start to the exact frame where the loop begins, as far
+// back as recent output goes
+long Loop_Detector::find_intro(long start, long loop) const {
+  long oldest = max(count_ - (long)recent_.size(), 0L);
+  while (start > oldest && frame(start - 1) == frame(start - 1 + loop))
+    start--;
+  return start;
+}
+
+void Loop_Detector::check_pending() {
+  // Candidates are resolved in order, so the earliest loop wins. Matching
+  // the nearest earlier block already finds the shortest period first.
+  while (!pending_.empty()) {
+    Candidate &c = pending_.front();
+    if (c.failed) {
+      pending_.pop_front();
+      continue;
+    }
+    if (c.checked < max(c.loop, verify_))
+      return;
+
+    intro_ = c.intro;
+    loop_ = c.loop;
+    pending_.clear();
+    return;
+  }
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __LOOP_DETECTOR_H__
+#define __LOOP_DETECTOR_H__
+
+#include "common.h"
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+// Finds the intro and loop length of looping music by looking for the
+// earliest span of the output that repeats exactly.
+//
+// Output is fed in as it is rendered. Every block of block_size frames is
+// fingerprinted and indexed by hash, and a rolling hash of the last
+// block_size frames is looked up in that index at every frame. Each hit is a
+// candidate loop, which is refined to the exact frame where the loop starts
+// and then verified block by block as more output comes in.
+//
+// Only block hashes are kept for the whole track, plus the last few minutes
+// of output, so memory doesn't grow with the length analyzed. The start of
+// loops longer than that is only found to the nearest block.
+class Loop_Detector {
+public:
+  explicit Loop_Detector(long sample_rate);
+
+  // Ignore loops shorter than msec milliseconds
+  void set_min_loop(long msec);
+
+  // Require the loop to repeat for at least msec milliseconds (or one whole
+  // loop, if longer) before accepting it
+  void set_verify_length(long msec);
+
+  // Frames per fingerprinted block
+  void set_block_size(int frames);
+
+  // Forget everything fed so far
+  void reset();
+
+  // Feed count samples (count / 2 stereo frames). Returns true once a loop
+  // has been found.
+  bool feed(const sample_t *in, int count);
+
+  // True if a loop was found
+  bool found() const { return loop_ > 0; }
+
+  // Intro and loop length in stereo frames, if found
+  long intro_frames() const { return intro_; }
+  long loop_frames() const { return loop_; }
+
+  // Intro and loop length in milliseconds, like gme_info_t::intro_length and
+  // gme_info_t::loop_length
+  long intro_msec() const { return intro_ * 1000 / sample_rate_; }
+  long loop_msec() const { return loop_ * 1000 / sample_rate_; }
+
+private:
+  struct Candidate {
+    long start;   // first frame of matched block
+    long loop;    // loop length in frames
+    long intro;   // frame where the loop begins
+    long checked; // frames from start known to repeat
+    bool failed;
+  };
+
+  long sample_rate_;
+  long min_loop_;
+  long verify_;
+  int block_size_;
+
+  std::vector<uint32_t> recent_; // last frames fed, as a ring
+  long recent_mask_;
+  long count_; // frames fed so far
+  std::vector<uint64_t> block_hashes_;
+  std::unordered_multimap<uint64_t, long> blocks_;
+  std::deque<Candidate> pending_;
+  uint64_t hash_;
+  uint64_t base_pow_;
+  long intro_;
+  long loop_;
+
+  void add_frame(uint32_t frame);
+  uint32_t frame(long i) const { return recent_[i & recent_mask_]; }
+  long find_intro(long start, long loop) const;
+  void check_pending();
+};
+
+#endif // __LOOP_DETECTOR_H__
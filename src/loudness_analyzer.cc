@@ -0,0 +1,257 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "loudness_analyzer.h"
+#include "track_cache.h"
+#include "work_queue.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+using namespace std;
+
+// Number of samples emulated at a time
+const int analyze_block = 8192;
+
+// Blocks quieter than this are ignored, in LUFS
+const double absolute_gate = -70;
+
+// Blocks this many LU below the loudness of the remaining ones are ignored
+const double relative_gate = 10;
+
+// True peaks are kept under this level when normalizing, in dBTP
+const double peak_ceiling = -1;
+
+const int Loudness_Meter::peak_taps;
+
+// Phases of the true peak oversampling filter
+const int peak_phases = 4;
+
+// Coefficients of the oversampling filter by phase, newest sample first:
+// windowed sinc with its cutoff at the original Nyquist frequency
+static struct Oversampling_Filter {
+  float taps[peak_phases][Loudness_Meter::peak_taps];
+
+  Oversampling_Filter() {
+    const int length = peak_phases * Loudness_Meter::peak_taps;
+    const double center = (length - 1) / 2.0;
+    for (int p = 0; p < peak_phases; p++) {
+      for (int t = 0; t < Loudness_Meter::peak_taps; t++) {
+        double n = peak_phases * t + p - center;
+        double x = n / peak_phases;
+        double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+        double window = 0.5 + 0.5 * cos(M_PI * n / (center + 1));
+        taps[p][t] = sinc * window;
+      }
+    }
+  }
+} oversampling;
+
+double Loudness_Meter::Biquad::run(double x) {
+  double y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+  x2 = x1;
+  x1 = x;
+  y2 = y1;
+  y1 = y;
+  return y;
+}
+
+Loudness_Meter::Loudness_Meter() { init(44100); }
+
+void Loudness_Meter::init(long rate) {
+  // K-weighting: high shelf modelling the head, then a high pass. These are
+  // the BS.1770 filters, designed for any rate instead of the 48000 Hz
+  // coefficients from the standard.
+  double k = tan(M_PI * 1681.974450955533 / rate);
+  double q = 0.7071752369554196;
+  double vh = pow(10, 3.999843853973347 / 20);
+  double vb = pow(vh, 0.4996667741545416);
+  double a0 = 1 + k / q + k * k;
+  Biquad shelf = {(vh + vb * k / q + k * k) / a0, 2 * (k * k - vh) / a0,
+                  (vh - vb * k / q + k * k) / a0, 2 * (k * k - 1) / a0,
+                  (1 - k / q + k * k) / a0, 0, 0, 0, 0};
+
+  k = tan(M_PI * 38.13547087602444 / rate);
+  q = 0.5003270373238773;
+  a0 = 1 + k / q + k * k;
+  Biquad highpass = {1, -2, 1, 2 * (k * k - 1) / a0, (1 - k / q + k * k) / a0,
+                     0, 0, 0, 0};
+
+  for (int c = 0; c < 2; c++) {
+    shelf_[c] = shelf;
+    highpass_[c] = highpass;
+  }
+
+  step_frames_ = max(rate / 10, 1L);
+  step_count_ = 0;
+  step_power_ = 0;
+  steps_.clear();
+  memset(history_, 0, sizeof(history_));
+  peak_ = 0;
+}
+
+void Loudness_Meter::feed(const float *in, long count) {
+  for (long i = 0; i + 1 < count; i += 2) {
+    for (int c = 0; c < 2; c++) {
+      double x = in[i + c];
+
+      double y = highpass_[c].run(shelf_[c].run(x));
+      step_power_ += y * y;
+
+      // History holds the last peak_taps samples, newest first
+      float *h = history_[c];
+      memmove(h + 1, h, (peak_taps - 1) * sizeof(float));
+      h[0] = x;
+      for (int p = 0; p < peak_phases; p++) {
+        float sum = 0;
+        for (int t = 0; t < peak_taps; t++)
+          sum += h[t] * oversampling.taps[p][t];
+        peak_ = max(peak_, (double)fabs(sum));
+      }
+    }
+
+    if (++step_count_ == step_frames_) {
+      steps_.push_back(step_power_ / step_frames_);
+      step_count_ = 0;
+      step_power_ = 0;
+    }
+  }
+}
+
+// Loudness of mean square power
+static double power_lufs(double power) {
+  return -0.691 + 10 * log10(power);
+}
+
+double Loudness_Meter::integrated() const {
+  // Gating blocks are 400 ms long, made of four 100 ms steps
+  vector<double> blocks;
+  for (size_t i = 3; i < steps_.size(); i++) {
+    double power = (steps_[i - 3] + steps_[i - 2] + steps_[i - 1] +
+                    steps_[i]) / 4;
+    if (power > 0 && power_lufs(power) > absolute_gate)
+      blocks.push_back(power);
+  }
+  if (blocks.empty())
+    return absolute_gate;
+
+  double sum = 0;
+  for (double power : blocks)
+    sum += power;
+  double gate = power_lufs(sum / blocks.size()) - relative_gate;
+
+  sum = 0;
+  long count = 0;
+  for (double power : blocks) {
+    if (power_lufs(power) > gate) {
+      sum += power;
+      count++;
+    }
+  }
+  return count ? power_lufs(sum / count) : absolute_gate;
+}
+
+double Loudness_Meter::true_peak() const {
+  return 20 * log10(max(peak_, 1e-10));
+}
+
+Loudness_Analyzer::Loudness_Analyzer() { sample_rate_ = 44100; }
+
+double Loudness_Analyzer::gain_for(double loudness, double peak,
+                                   double target) {
+  // Leave silent tracks alone
+  if (loudness <= absolute_gate)
+    return 0;
+  return min(target - loudness, peak_ceiling - peak);
+}
+
+gme_err_t Loudness_Analyzer::analyze(Renderer &r, int track,
+                                     Result &result) {
+  result.track = track;
+  result.loudness = absolute_gate;
+  result.peak = -200;
+
+  // Measure the track as it is played, fade out included
+  RETURN_ERR(r.start_track(track));
+
+  Loudness_Meter meter;
+  meter.init(r.sample_rate());
+
+  float buf[analyze_block];
+  while (!r.track_ended() && r.tell() < r.track_samples()) {
+    long count = min(r.track_samples() - r.tell(), (long)analyze_block);
+    RETURN_ERR(r.play(count, buf));
+    meter.feed(buf, count);
+  }
+
+  result.loudness = meter.integrated();
+  result.peak = meter.true_peak();
+  return 0;
+}
+
+gme_err_t Loudness_Analyzer::analyze_file(const string &path, int jobs,
+                                          vector<Result> &results,
+                                          Track_Cache *cache,
+                                          callback_t done) {
+  Renderer probe;
+  RETURN_ERR(probe.load_file(path, sample_rate_));
+  int count = probe.track_count();
+  probe.unload();
+
+  results.assign(count, Result());
+
+  Work_Queue queue(min(jobs > 0 ? jobs : Work_Queue::core_count(),
+                       max(count, 1)));
+  vector<unique_ptr<Renderer>> renderers(queue.worker_count());
+
+  mutex err_mutex;
+  gme_err_t first_err = 0;
+
+  for (int i = 0; i < count; i++) {
+    queue.push([&, i](int worker) {
+      Result &result = results[i];
+      result.track = i;
+
+      gme_err_t err = 0;
+      auto &renderer = renderers[worker];
+      if (!renderer) {
+        renderer.reset(new Renderer);
+        err = renderer->load_file(path, sample_rate_);
+      }
+      if (!err)
+        err = analyze(*renderer, i, result);
+
+      if (err) {
+        lock_guard<mutex> lock(err_mutex);
+        if (!first_err)
+          first_err = err;
+      } else if (cache) {
+        cache->put(path, i, {result.loudness, result.peak});
+      }
+
+      if (done)
+        done(result, err);
+    });
+  }
+
+  queue.run();
+
+  if (cache && !first_err)
+    RETURN_ERR(cache->save());
+  return first_err;
+}
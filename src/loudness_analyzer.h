@@ -0,0 +1,108 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __LOUDNESS_ANALYZER_H__
+#define __LOUDNESS_ANALYZER_H__
+
+#include "renderer.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+class Track_Cache;
+
+// Integrated loudness and true peak of a stereo signal, as defined by
+// EBU R128 / ITU-R BS.1770: K-weighted power over 400 ms blocks with 75%
+// overlap, gated at -70 LUFS and then 10 LU below the ungated loudness.
+class Loudness_Meter {
+public:
+  Loudness_Meter();
+
+  // Start measuring a signal at sample rate
+  void init(long rate);
+
+  // Add count samples (count / 2 stereo frames)
+  void feed(const float *in, long count);
+
+  // Integrated loudness in LUFS, or -70 if everything was gated
+  double integrated() const;
+
+  // Peak of the signal oversampled 4 times, in dBTP
+  double true_peak() const;
+
+  // Taps per phase of the oversampling filter
+  static const int peak_taps = 12;
+
+private:
+  // Direct form I biquad
+  struct Biquad {
+    double b0, b1, b2, a1, a2;
+    double x1, x2, y1, y2;
+    double run(double x);
+  };
+
+  Biquad shelf_[2];
+  Biquad highpass_[2];
+  long step_frames_;
+  long step_count_;
+  double step_power_;
+  std::vector<double> steps_;
+  float history_[2][peak_taps];
+  double peak_;
+};
+
+// Measures loudness of tracks by emulating them as fast as possible, with
+// no audio output, for as long as they would play.
+class Loudness_Analyzer {
+public:
+  // Result for one track
+  struct Result {
+    int track;
+    // Integrated loudness in LUFS
+    double loudness;
+    // True peak in dBTP
+    double peak;
+  };
+
+  // Called from worker threads as each track is analyzed
+  typedef std::function<void(const Result &, gme_err_t)> callback_t;
+
+  Loudness_Analyzer();
+
+  // Sample rate used for emulation. K-weighting stresses high frequencies,
+  // so rates below 44100 tend to underestimate loudness.
+  void set_sample_rate(long rate) { sample_rate_ = rate; }
+
+  // Analyze track on a renderer that already has the file loaded
+  gme_err_t analyze(Renderer &, int track, Result &);
+
+  // Analyze all tracks of file, in parallel with given number of worker
+  // threads (or one per core if 0). Results are stored in cache, if any, as
+  // loudness and true peak.
+  gme_err_t analyze_file(const std::string &path, int jobs,
+                         std::vector<Result> &results,
+                         Track_Cache *cache = nullptr,
+                         callback_t done = nullptr);
+
+  // Gain in dB that brings a track to target loudness in LUFS, reduced so
+  // that its true peak stays under -1 dBTP
+  static double gain_for(double loudness, double peak, double target);
+
+private:
+  long sample_rate_;
+};
+
+#endif // __LOUDNESS_ANALYZER_H__
@@ -28,37 +28,60 @@
 #define PRINTF(...) printf(__VA_ARGS__)
 #endif
 
+#include "batch.h"
+#include "bench.h"
 #include "cxxopts.h"
+#include "dsp_chain.h"
+#include "length_analyzer.h"
+#include "loudness_analyzer.h"
+#include "json.h"
+#include "metadata_index.h"
+#include "play_queue.h"
 #include "player.h"
+#include "track_cache.h"
+#include "tripwire.h"
+#include "work_queue.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <glob.h>
+#include <mutex>
+#include <poll.h>
+#include "wave_writer.h"
 
 using namespace std;
 
-void start_track(Player *player, int track, bool dry_run = false) {
-#ifdef CURSES
-  move(0, 0);
-#endif
+// Playing time added to the current track by the extend key, in msec
+const long extend_msec = 60000;
 
-  // Start first track
-  if (auto err = player->start_track(track, dry_run)) {
-    PRINTF("Player error: %s\n", err);
-    exit(1);
-  }
+// Format a title line for the current track
+string track_title(const Renderer &renderer) {
+  int track = renderer.current_track();
 
   // Get track information
-  long seconds = player->track_info().length / 1000;
-  const char *game = player->track_info().game;
+  long seconds = renderer.track_info().length / 1000;
+  const char *game = renderer.track_info().game;
   if (!*game) {
     // extract filename
-    game = strrchr(player->filename().c_str(), '\\'); // DOS
+    game = strrchr(renderer.filename().c_str(), '\\'); // DOS
     if (!game)
-      game = strrchr(player->filename().c_str(), '/'); // UNIX
+      game = strrchr(renderer.filename().c_str(), '/'); // UNIX
     if (!game)
-      game = player->filename().c_str();
+      game = renderer.filename().c_str();
     else
       game++; // skip path separator
   }
 
-  auto &info = player->track_info();
+  char title[512];
+  snprintf(title, sizeof(title), "%s: %d/%d %s (%ld:%02ld)", game, track + 1,
+      renderer.track_count(), renderer.track_info().song,
+      seconds / 60, seconds % 60);
+
+  return title;
+}
+
+void show_track_info(const Renderer &renderer) {
+  auto &info = renderer.track_info();
 
   if (strcmp(info.game, "") != 0)
     PRINTF("Game:      %s\n", info.game);
@@ -71,12 +94,70 @@ void start_track(Player *player, int track, bool dry_run = false) {
   if (strcmp(info.dumper, "") != 0)
     PRINTF("Dumper:    %s\n", info.dumper);
 
-  char title[512];
-  sprintf(title, "%s: %d/%d %s (%ld:%02ld)", game, track + 1,
-      player->track_count(), player->track_info().song,
-      seconds / 60, seconds % 60);
+  PRINTF("%s\n\n", track_title(renderer).c_str());
+}
+
+// Show playback buffer status on the last line
+void show_status(Player *player) {
+#ifdef CURSES
+  int y, x;
+  getyx(stdscr, y, x);
+  long seconds = player->tell() / 1000;
+  string muted;
+  int mask = player->muted_voices();
+  for (int i = 0; i < 32; i++) {
+    if (mask & (1 << i))
+      muted += " " + to_string(i + 1);
+  }
+  mvprintw(LINES - 4, 0, "Tempo: %.2f  Stereo depth: %.1f  Accuracy: %s  "
+           "Muted:%s", player->tempo(), player->stereo_depth(),
+           player->accuracy() ? "on" : "off", muted.empty() ? " none"
+                                                            : muted.c_str());
+  clrtoeol();
+  mvprintw(LINES - 2, 0, "Position: %ld:%02ld  Snapshots: %d/%d  Seek: %.1f ms",
+           seconds / 60, seconds % 60, player->seek_index().ready_count(),
+           player->seek_index().size(), player->seek_latency());
+  clrtoeol();
+  auto &stats = player->stats();
+  mvprintw(LINES - 3, 0, "Callback: %s p99, %s max  Render: %s p99, %s max",
+           format_ns(stats.callback.percentile(0.99)).c_str(),
+           format_ns(stats.callback.max()).c_str(),
+           format_ns(stats.render.percentile(0.99)).c_str(),
+           format_ns(stats.render.max()).c_str());
+  clrtoeol();
+  mvprintw(LINES - 1, 0,
+           "Buffer: %3d/%d ms  Underruns: %ld  Late: %ld  Device: %ld Hz %s "
+           "%d",
+           player->buffered_msec(), player->ahead_msec(), player->underruns(),
+           stats.late.load(), player->device_rate(), player->device_format(),
+           player->device_buffer());
+  clrtoeol();
+  move(y, x);
+  refresh();
+#else
+  (void)player;
+#endif
+}
+
+// Sleep until a key is pressed or the player signals a track change or end.
+// While playing, also wake up when the position shown changes.
+void wait_events(Player *player, bool playing) {
+  pollfd fds[2] = {{player->event_fd(), POLLIN, 0}, {0, POLLIN, 0}};
+#ifdef CURSES
+  int timeout = playing ? 1000 - player->tell() % 1000 : -1;
+  poll(fds, 2, timeout);
+#else
+  (void)playing;
+  poll(fds, 1, -1);
+#endif
+}
+
+void show_track(Player *player) {
+#ifdef CURSES
+  move(0, 0);
+#endif
 
-  PRINTF("%s\n\n", title);
+  show_track_info(player->renderer());
 
 #ifdef CURSES
   move(5, 0);
@@ -84,18 +165,574 @@ void start_track(Player *player, int track, bool dry_run = false) {
 #endif
 }
 
+// Last error shown while playing, printed again once curses is done
+string last_error;
+
+// Show an error above the status lines, where it stays until the next one
+void show_error(const string &message) {
+  last_error = message;
+#ifdef CURSES
+  int y, x;
+  getyx(stdscr, y, x);
+  mvprintw(LINES - 5, 0, "%s", message.c_str());
+  clrtoeol();
+  move(y, x);
+  refresh();
+#else
+  fprintf(stderr, "%s\n", message.c_str());
+#endif
+}
+
+// Print audio path timing, to tell emulation cost from scheduling jitter
+void dump_stats(Player *player) {
+  auto &stats = player->stats();
+  fprintf(stderr, "Audio device: %ld Hz, %s, %d frames  Emulation: %ld Hz\n",
+          player->device_rate(), player->device_format(),
+          player->device_buffer(), player->emu_rate());
+  fprintf(stderr, "Audio buffer: %s  Ahead: %d ms\n",
+          format_ns(player->buffer_ns()).c_str(), player->ahead_msec());
+  fprintf(stderr, "Callback duration: %s\n%s",
+          stats.callback.summary().c_str(), stats.callback.dump().c_str());
+  fprintf(stderr, "Callback interval: %s\n%s",
+          stats.interval.summary().c_str(), stats.interval.dump().c_str());
+  fprintf(stderr, "Render block: %s\n%s", stats.render.summary().c_str(),
+          stats.render.dump().c_str());
+  fprintf(stderr, "Underruns: %ld  Late callbacks: %ld\n",
+          player->underruns(), stats.late.load());
+}
+
+// Report which real-time guarantees were obtained
+void print_realtime(Player *player) {
+  auto r = player->realtime();
+  auto status = [](gme_err_t err) { return err ? err : "yes"; };
+  fprintf(stderr, "Real-time mode:\n");
+  fprintf(stderr, "  Locked memory:   %s%s\n", status(r.memory),
+          !r.memory && !r.memory_future ? " (again after each load)" : "");
+  fprintf(stderr, "  FIFO scheduling: %s\n", status(r.scheduling));
+  fprintf(stderr, "  Render CPU:      %s\n", status(r.render_cpu));
+  fprintf(stderr, "  Audio CPU:       %s\n", status(r.audio_cpu));
+}
+
+// Report guarantees lost since start: memory loaded while playing may have
+// gone over the lock limit, and threads may have been refused what the
+// probe got
+void print_realtime_lost(Player *player,
+                         const Player::Realtime_Report &before) {
+  auto r = player->realtime();
+  auto lost = [](const char *what, gme_err_t was, gme_err_t is) {
+    if (is && !was)
+      fprintf(stderr, "Real-time mode: %s: %s\n", what, is);
+  };
+  lost("memory not locked", before.memory, r.memory);
+  lost("no FIFO scheduling", before.scheduling, r.scheduling);
+  lost("render CPU not pinned", before.render_cpu, r.render_cpu);
+  lost("audio CPU not pinned", before.audio_cpu, r.audio_cpu);
+}
+
+int list_devices() {
+  if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+    cerr << "Failed to initialize SDL" << endl;
+    return 1;
+  }
+  atexit(SDL_Quit);
+
+  for (auto &name : Player::devices())
+    cout << name << endl;
+  return 0;
+}
+
+// Parse time as seconds ("90", "12.5") or minutes and seconds ("1:30").
+// Returns milliseconds, or -1 if invalid.
+long parse_time(const string &text) {
+  int minutes = 0;
+  double seconds = 0;
+  char extra;
+  if (sscanf(text.c_str(), "%d:%lf%c", &minutes, &seconds, &extra) != 2 &&
+      (minutes = 0, sscanf(text.c_str(), "%lf%c", &seconds, &extra) != 1))
+    return -1;
+  if (minutes < 0 || seconds < 0)
+    return -1;
+  return (long)((minutes * 60 + seconds) * 1000);
+}
+
+void seek(Player *player, long msec) {
+  if (auto err = player->seek(msec)) {
+    PRINTF("Player error: %s\n", err);
+    exit(1);
+  }
+}
+
+// Play track at pos, loading its file first if it is not the current one.
+// NULL on success, otherwise error string.
+gme_err_t play(Player *player, const Play_Queue &queue,
+               const Play_Queue::Position &pos) {
+  const string &path = queue[pos.entry].path;
+  // A file that failed to load keeps its name, but has no tracks
+  if (player->filename() != path || !player->track_count())
+    RETURN_ERR(player->load_file(path));
+  RETURN_ERR(player->start_track(pos.track));
+  show_track(player);
+  return 0;
+}
+
+// Play track at pos or, if it fails, the first one after it that plays,
+// showing each one skipped. Going backwards, tries the ones before it first.
+// Sets pos to the track playing. False if nothing is left to play.
+bool play_from(Player *player, const Play_Queue &queue,
+               Play_Queue::Position &pos, bool backwards = false) {
+  while (auto err = play(player, queue, pos)) {
+    show_error("Skipped " + queue[pos.entry].path + ": " + err);
+    Play_Queue::Position other;
+    if (backwards && queue.prev(pos, other)) {
+      pos = other;
+      continue;
+    }
+    backwards = false;
+    if (!queue.next(pos, player->track_count(), other))
+      return false;
+    pos = other;
+  }
+  return true;
+}
+
+// Line up the queue entry after pos in the background, so playback
+// continues without a gap when it ends. Sets next to its position.
+void prepare_next(Player *player, const Play_Queue &queue,
+                  const Play_Queue::Position &pos, bool single,
+                  Play_Queue::Position &next) {
+  if (single || !queue.next(pos, player->track_count(), next))
+    return;
+  player->prepare_next(queue[next.entry].path, next.track);
+}
+
+// Render a single track to a WAV or raw PCM file, without opening any audio
+// device. Runs as fast as the emulator can go.
+int render_track(const string &input, int track, const string &output,
+                 long start_at, Dsp_Chain &dsp, int dither) {
+  Renderer renderer;
+  if (auto err = renderer.load_file(input)) {
+    cerr << "Player error: " << err << endl;
+    return 1;
+  }
+
+  if (track < 1 || track > renderer.track_count()) {
+    cerr << "Invalid track number. Must be between 1 and "
+         << renderer.track_count() << endl;
+    return 1;
+  }
+
+  if (auto err = renderer.start_track(track - 1)) {
+    cerr << "Player error: " << err << endl;
+    return 1;
+  }
+  if (start_at > 0) {
+    if (auto err = renderer.seek(start_at)) {
+      cerr << "Player error: " << err << endl;
+      return 1;
+    }
+  }
+  cout << "Rendering " << track_title(renderer) << " to " << output << endl;
+
+  Wave_Writer writer;
+  writer.set_dither(dither);
+  gme_err_t err = writer.open(output, renderer.sample_rate(),
+                              Wave_Writer::is_raw_path(output));
+  dsp.init(renderer.sample_rate());
+  if (!err)
+    err = renderer.render(writer, &dsp);
+  if (!err)
+    err = writer.close();
+  if (err) {
+    cerr << "Render error: " << err << endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+// Render all tracks of a file into a directory, in parallel
+int render_all_tracks(const string &input, const string &out_dir, int jobs,
+                      const Dsp_Chain &dsp, int dither) {
+  mutex out_mutex;
+  Batch_Renderer batch(jobs);
+  batch.set_dsp(dsp);
+  batch.set_dither(dither);
+  gme_err_t err = batch.render(input, out_dir, [&](const Renderer &renderer,
+                                                   const string &output,
+                                                   gme_err_t err) {
+    lock_guard<mutex> lock(out_mutex);
+    if (err)
+      cerr << output << ": " << err << endl;
+    else
+      cout << "Rendered " << track_title(renderer) << " to " << output << endl;
+  });
+
+  if (err) {
+    cerr << "Render error: " << err << endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Render each voice of a track into its own file, in parallel
+int render_stems(const string &input, int track, const string &out_dir,
+                 int jobs, const Dsp_Chain &dsp, int dither) {
+  mutex out_mutex;
+  Batch_Renderer batch(jobs);
+  batch.set_dsp(dsp);
+  batch.set_dither(dither);
+  gme_err_t err = batch.render_stems(input, track - 1, out_dir,
+                                     [&](const Renderer &,
+                                         const string &output,
+                                         gme_err_t err) {
+    lock_guard<mutex> lock(out_mutex);
+    if (err)
+      cerr << output << ": " << err << endl;
+    else
+      cout << "Rendered " << output << endl;
+  });
+
+  if (err) {
+    cerr << "Render error: " << err << endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Parse comma separated list of numbers, e.g. "1,2.5,3"
+template <typename T> bool parse_list(const string &text, vector<T> &out) {
+  out.clear();
+  size_t start = 0;
+  while (start <= text.size()) {
+    size_t end = text.find(',', start);
+    if (end == string::npos)
+      end = text.size();
+    char *rest;
+    string item = text.substr(start, end - start);
+    double value = strtod(item.c_str(), &rest);
+    if (item.empty() || *rest)
+      return false;
+    out.push_back((T)value);
+    start = end + 1;
+  }
+  return true;
+}
+
+// Measure emulation throughput and print it as JSON
+int bench(const string &input, const cxxopts::ParseResult &result) {
+  Benchmark benchmark;
+  benchmark.set_duration(result["bench-seconds"].as<double>());
+
+  vector<int> tracks, qualities;
+  vector<long> rates;
+  vector<double> tempos;
+  if (!parse_list(result["bench-rates"].as<string>(), rates) ||
+      !parse_list(result["bench-tempos"].as<string>(), tempos) ||
+      !parse_list(result["bench-qualities"].as<string>(), qualities) ||
+      (result.count("bench-tracks") &&
+       !parse_list(result["bench-tracks"].as<string>(), tracks))) {
+    cerr << "Invalid benchmark list" << endl;
+    return 1;
+  }
+  for (auto &t : tracks)
+    t--; // Track is 0-numbered
+  benchmark.set_tracks(tracks);
+  benchmark.set_sample_rates(rates);
+  benchmark.set_tempos(tempos);
+  benchmark.set_resampling(result["bench-resample-rate"].as<long>(),
+                           qualities);
+
+  if (auto err = benchmark.run(input)) {
+    cerr << "Benchmark error: " << err << endl;
+    return 1;
+  }
+
+  cout << benchmark.to_json(input);
+  return 0;
+}
+
+// Format milliseconds as M:SS.mmm
+string format_msec(long msec) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%ld:%02ld.%03ld", msec / 60000,
+           msec / 1000 % 60, msec % 1000);
+  return buf;
+}
+
+// Measure real length of all tracks and store them in the length cache
+int scan_lengths(const string &input, int jobs, long rate,
+                 Track_Cache &cache) {
+  Length_Analyzer analyzer;
+  analyzer.set_sample_rate(rate);
+
+  vector<Length_Analyzer::Result> results;
+  gme_err_t err = analyzer.analyze_file(input, jobs, results, &cache);
+  if (err) {
+    cerr << "Scan error: " << err << endl;
+    return 1;
+  }
+
+  for (auto &r : results) {
+    printf("Track %2d: ", r.track + 1);
+    if (r.length >= 0) {
+      printf("%s\n", format_msec(r.length).c_str());
+    } else if (r.loop_length > 0) {
+      printf("intro %s, loop %s\n", format_msec(r.intro_length).c_str(),
+             format_msec(r.loop_length).c_str());
+    } else {
+      printf("loops\n");
+    }
+  }
+  return 0;
+}
+
+// Measure loudness of all tracks and store it in the loudness cache
+int scan_loudness(const string &input, int jobs, long rate, double target,
+                  Track_Cache &cache) {
+  Loudness_Analyzer analyzer;
+  analyzer.set_sample_rate(rate);
+
+  vector<Loudness_Analyzer::Result> results;
+  gme_err_t err = analyzer.analyze_file(input, jobs, results, &cache);
+  if (err) {
+    cerr << "Scan error: " << err << endl;
+    return 1;
+  }
+
+  for (auto &r : results) {
+    printf("Track %2d: %6.1f LUFS, %6.1f dBTP, gain %+5.1f dB\n",
+           r.track + 1, r.loudness, r.peak,
+           Loudness_Analyzer::gain_for(r.loudness, r.peak, target));
+  }
+  return 0;
+}
+
+// Metadata of file as a single line JSON object
+string info_json(const File_Metadata &m, gme_err_t err) {
+  string out = "{\"path\": " + json_string(m.path);
+  if (err)
+    return out + ", \"error\": " + json_string(err) + "}";
+
+  char buf[256];
+  snprintf(buf, sizeof(buf), ", \"size\": %lld, \"mtime\": %lld", m.size,
+           m.mtime);
+  out += buf;
+  out += ", \"system\": " + json_string(m.system);
+  out += ", \"game\": " + json_string(m.game);
+  out += ", \"author\": " + json_string(m.author);
+  out += ", \"copyright\": " + json_string(m.copyright);
+  out += ", \"comment\": " + json_string(m.comment);
+  out += ", \"dumper\": " + json_string(m.dumper);
+  out += ", \"tracks\": [";
+  for (size_t i = 0; i < m.tracks.size(); i++) {
+    const File_Metadata::Track &t = m.tracks[i];
+    snprintf(buf, sizeof(buf),
+             "%s{\"track\": %d, \"song\": ", i ? ", " : "", (int)i + 1);
+    out += buf;
+    out += json_string(t.song);
+    snprintf(buf, sizeof(buf),
+             ", \"length\": %ld, \"intro_length\": %ld, "
+             "\"loop_length\": %ld, \"play_length\": %ld}",
+             t.length, t.intro_length, t.loop_length, t.play_length);
+    out += buf;
+  }
+  return out + "]}";
+}
+
+// Print metadata of every file matching the given paths or glob patterns as
+// JSON lines, reading files in parallel. Doesn't touch the audio device.
+int print_info(const vector<string> &inputs, int jobs) {
+  vector<string> paths;
+  for (auto &input : inputs) {
+    glob_t g;
+    if (glob(input.c_str(), GLOB_NOCHECK, nullptr, &g) == 0) {
+      for (size_t i = 0; i < g.gl_pathc; i++)
+        paths.push_back(g.gl_pathv[i]);
+    }
+    globfree(&g);
+  }
+  if (paths.empty())
+    return 0;
+
+  Work_Queue queue(min(jobs > 0 ? jobs : Work_Queue::core_count(),
+                       (int)paths.size()));
+  mutex out_mutex;
+  int failed = 0;
+  for (auto &path : paths) {
+    queue.push([&](int) {
+      File_Metadata m;
+      gme_err_t err = m.read(path);
+      string line = info_json(m, err);
+      lock_guard<mutex> lock(out_mutex);
+      puts(line.c_str());
+      if (err)
+        failed++;
+    });
+  }
+  queue.run();
+  return failed ? 1 : 0;
+}
+
+// Index metadata of every music file under dir
+int index_dir(const string &dir, int jobs) {
+  string path = Metadata_Index::default_path(dir);
+  if (path.empty()) {
+    cerr << "Couldn't open directory " << dir << endl;
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  mutex out_mutex;
+  Metadata_Index::Update_Result r;
+  gme_err_t err = Metadata_Index::update(
+      dir, path, jobs, r, [&](const string &file, gme_err_t err) {
+        if (err) {
+          lock_guard<mutex> lock(out_mutex);
+          cerr << file << ": " << err << endl;
+        }
+      });
+  if (err) {
+    cerr << "Index error: " << err << endl;
+    return 1;
+  }
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  printf("Indexed %d files (%d unchanged, %d read, %d failed) in %.1f ms\n",
+         r.files, r.reused, r.read, r.failed, elapsed.count());
+  printf("Index: %s\n", path.c_str());
+  return 0;
+}
+
+// List indexed tracks under dir whose game, author, song or path contain
+// text, ignoring case
+int search_index(const string &dir, const string &text) {
+  Metadata_Index index;
+  if (auto err = index.open(Metadata_Index::default_path(dir))) {
+    cerr << "Index error: " << err << endl;
+    return 1;
+  }
+  if (!index.file_count()) {
+    cerr << "No index for " << dir << ", create it with --index" << endl;
+    return 1;
+  }
+
+  const char *q = text.c_str();
+  for (int i = 0; i < index.file_count(); i++) {
+    Metadata_Index::File f = index.file(i);
+    bool file_match = strcasestr(f.game, q) || strcasestr(f.author, q) ||
+                      strcasestr(f.path, q);
+    for (int t = 0; t < f.track_count; t++) {
+      Metadata_Index::Track track = index.track(i, t);
+      if (!file_match && !strcasestr(track.song, q))
+        continue;
+      printf("%s\t%d\t%s\t%s\t%s\n", f.path, t + 1, f.game, track.song,
+             track.length > 0 ? format_msec(track.length).c_str() : "-");
+    }
+  }
+  return 0;
+}
+
 int main(int argc, const char *argv[]) {
   try {
     cxxopts::Options options(argv[0], "nsfp 0.1 - NSF/NSFE player");
 
-    options.positional_help("INPUT").show_positional_help();
+    options.positional_help("INPUT...").show_positional_help();
 
     options.add_options()
-      ("input", "Input file", cxxopts::value<string>())
-      ("i,info", "Only show info")
+      ("input", "Input file", cxxopts::value<vector<string>>())
+      ("i,info", "Print info of every INPUT file or glob pattern as JSON "
+        "lines, without playing")
       ("t,track", "Start playing from a specific track",
         cxxopts::value<int>()->default_value("1"))
       ("s,single", "Stop after playing current track")
+      ("r,render", "Render track to a WAV file (or raw PCM if FILE ends in "
+        ".raw or .pcm) instead of playing it", cxxopts::value<string>(),
+        "FILE")
+      ("R,render-all", "Render every track to a WAV file in DIR, in parallel",
+        cxxopts::value<string>(), "DIR")
+      ("stems", "Render each voice of the track, and the full mix, to its "
+        "own WAV file in DIR, in parallel", cxxopts::value<string>(), "DIR")
+      ("j,jobs", "Number of tracks to render at the same time (default: one "
+        "per core)", cxxopts::value<int>()->default_value("0"), "NUM")
+      ("index", "Index metadata of every NSF/NSFE file under INPUT, a "
+        "directory, for --search")
+      ("search", "List indexed tracks under INPUT whose game, author, song or "
+        "path contain TEXT", cxxopts::value<string>(), "TEXT")
+      ("L,scan-lengths", "Measure how long each track really plays, or "
+        "where it loops, and remember it for tracks without timing "
+        "information")
+      ("l,loops", "Number of loops to play before fading out, for tracks "
+        "with known loop points", cxxopts::value<int>()->default_value("2"),
+        "NUM")
+      ("fade", "Fade out tracks for MSEC milliseconds",
+        cxxopts::value<long>()->default_value("8000"), "MSEC")
+      ("fade-in", "Fade in for MSEC milliseconds after seeking",
+        cxxopts::value<long>()->default_value("50"), "MSEC")
+      ("fade-curve", "Shape of fades: log, linear or cosine",
+        cxxopts::value<string>()->default_value("log"), "NAME")
+      ("scan-loudness", "Measure loudness and true peak of each track, "
+        "to normalize them when playing")
+      ("scan-rate", "Sample rate used when scanning (default: 22050 for "
+        "lengths, 44100 for loudness)", cxxopts::value<long>(), "HZ")
+      ("target", "Loudness that scanned tracks are normalized to",
+        cxxopts::value<double>()->default_value("-18"), "LUFS")
+      ("no-normalize", "Play scanned tracks at their original loudness")
+      ("bench", "Measure emulation speed of every track and print it as "
+        "JSON")
+      ("bench-seconds", "Emulated seconds per measurement",
+        cxxopts::value<double>()->default_value("30"), "SEC")
+      ("bench-tracks", "Comma separated tracks to measure (default: all)",
+        cxxopts::value<string>(), "LIST")
+      ("bench-rates", "Comma separated sample rates to measure",
+        cxxopts::value<string>()->default_value("22050,44100,48000"), "LIST")
+      ("bench-tempos", "Comma separated tempos to measure",
+        cxxopts::value<string>()->default_value("1,2"), "LIST")
+      ("bench-resample-rate", "Also measure converting each sample rate to "
+        "HZ (0 to skip)", cxxopts::value<long>()->default_value("48000"),
+        "HZ")
+      ("bench-qualities", "Comma separated resampler qualities to measure",
+        cxxopts::value<string>()->default_value("0,1,2"), "LIST")
+      ("a,ahead", "Milliseconds of audio to render ahead of playback",
+        cxxopts::value<int>()->default_value("200"), "MSEC")
+      ("adaptive", "Start with as little audio ahead as possible and render "
+        "more ahead, up to --ahead, when playback runs dry")
+      ("device", "Play through audio device NAME", cxxopts::value<string>(),
+        "NAME")
+      ("list-devices", "List audio devices and exit")
+      ("rate", "Request sample rate HZ from the audio device",
+        cxxopts::value<long>()->default_value("44100"), "HZ")
+      ("emu-rate", "Emulate at HZ and convert to the device rate (default: "
+        "emulate at the device rate)", cxxopts::value<long>()
+        ->default_value("0"), "HZ")
+      ("resample-quality", "Quality of the conversion from --emu-rate, from "
+        "0 (cheapest) to 2 (best)", cxxopts::value<int>()->default_value("1"),
+        "NUM")
+      ("realtime", "Render and play with real-time priority and locked "
+        "memory, when permitted")
+      ("cpus", "Pin the render and audio threads to these two cores, in "
+        "real-time mode", cxxopts::value<string>(), "RENDER,AUDIO")
+      ("buffer", "Audio device buffer size, in frames, up to 32768",
+        cxxopts::value<int>()->default_value("0"), "FRAMES")
+      ("latency", "Audio device buffer duration, if --buffer is not given",
+        cxxopts::value<int>()->default_value("0"), "MSEC")
+      ("start-at", "Start playing at TIME, as seconds or MM:SS",
+        cxxopts::value<string>(), "TIME")
+      ("seek-interval", "Seconds between seek snapshots",
+        cxxopts::value<int>()->default_value("10"), "SEC")
+      ("snapshots", "Maximum number of seek snapshots per track",
+        cxxopts::value<int>()->default_value("32"), "NUM")
+      ("stats", "Print audio timing histograms on exit")
+      ("x,crossfade", "Crossfade tracks for MSEC milliseconds (default: "
+        "gapless)", cxxopts::value<int>()->default_value("0"), "MSEC")
+      ("gain", "Amplify output by DB decibels",
+        cxxopts::value<double>()->default_value("0"), "DB")
+      ("limiter", "Softly compress peaks instead of clipping them")
+      ("dc-filter", "Remove DC offset from output")
+      ("console-filter", "Emulate output filters of console NAME (nes or "
+        "famicom)", cxxopts::value<string>(), "NAME")
+      ("dither", "Dither 16-bit output with MODE: none, tpdf or shaped",
+        cxxopts::value<string>()->default_value("none"), "MODE")
       ("h,help", "Print this message");
 
     options.parse_positional({"input"});
@@ -107,16 +744,140 @@ int main(int argc, const char *argv[]) {
       return 0;
     }
 
+    if (result.count("list-devices")) {
+      return list_devices();
+    }
+
     if (!result.count("input")) {
       cerr << options.help({""}) << endl;
       return 1;
     }
 
     // Read options
-    const string input = result["input"].as<string>();
-    bool show_info = result["info"].as<bool>();
+    const vector<string> &inputs = result["input"].as<vector<string>>();
+    const string input = inputs[0];
+
+    if (result.count("info")) {
+      return print_info(inputs, result["jobs"].as<int>());
+    }
+
     int track = result["track"].as<int>();
     bool single = result["single"].as<bool>();
+    int crossfade = result["crossfade"].as<int>();
+
+    long start_at = 0;
+    if (result.count("start-at")) {
+      start_at = parse_time(result["start-at"].as<string>());
+      if (start_at < 0) {
+        cerr << "Invalid start time: " << result["start-at"].as<string>()
+             << endl;
+        return 1;
+      }
+    }
+
+    // Post-processing
+    Dsp_Chain dsp;
+    dsp.set_gain(result["gain"].as<double>());
+    dsp.enable_limiter(result["limiter"].as<bool>());
+    dsp.enable_dc_removal(result["dc-filter"].as<bool>());
+    if (result.count("console-filter")) {
+      string name = result["console-filter"].as<string>();
+      if (name == "nes") {
+        dsp.set_console_filter(Dsp_Chain::filter_nes);
+      } else if (name == "famicom") {
+        dsp.set_console_filter(Dsp_Chain::filter_famicom);
+      } else {
+        cerr << "Unknown console filter: " << name << endl;
+        return 1;
+      }
+    }
+    int dither;
+    string dither_name = result["dither"].as<string>();
+    if (dither_name == "none") {
+      dither = Quantizer::dither_none;
+    } else if (dither_name == "tpdf") {
+      dither = Quantizer::dither_tpdf;
+    } else if (dither_name == "shaped") {
+      dither = Quantizer::dither_shaped;
+    } else {
+      cerr << "Unknown dither: " << dither_name << endl;
+      return 1;
+    }
+
+    // Fades, also heard by scans and renders
+    int curve;
+    string curve_name = result["fade-curve"].as<string>();
+    if (curve_name == "log") {
+      curve = Renderer::curve_log;
+    } else if (curve_name == "linear") {
+      curve = Renderer::curve_linear;
+    } else if (curve_name == "cosine") {
+      curve = Renderer::curve_cosine;
+    } else {
+      cerr << "Unknown fade curve: " << curve_name << endl;
+      return 1;
+    }
+    long fade = result["fade"].as<long>();
+    long fade_in = result["fade-in"].as<long>();
+    if (fade < 0 || fade_in < 0) {
+      cerr << "Invalid fade length" << endl;
+      return 1;
+    }
+    Renderer::set_fade(fade, fade_in, curve);
+
+    // Measured lengths of tracks without timing information
+    Track_Cache lengths("lengths");
+    lengths.load();
+    Renderer::set_length_cache(&lengths);
+    Renderer::set_loop_count(result["loops"].as<int>());
+
+    if (result.count("index")) {
+      return index_dir(input, result["jobs"].as<int>());
+    }
+
+    if (result.count("search")) {
+      return search_index(input, result["search"].as<string>());
+    }
+
+    if (result.count("scan-lengths")) {
+      long rate = result.count("scan-rate") ? result["scan-rate"].as<long>()
+                                            : 22050;
+      return scan_lengths(input, result["jobs"].as<int>(), rate, lengths);
+    }
+
+    // Measured loudness, applied from here on
+    double target = result["target"].as<double>();
+    Track_Cache loudness("loudness");
+    loudness.load();
+
+    if (result.count("scan-loudness")) {
+      long rate = result.count("scan-rate") ? result["scan-rate"].as<long>()
+                                            : 44100;
+      return scan_loudness(input, result["jobs"].as<int>(), rate, target,
+                           loudness);
+    }
+
+    if (result.count("bench")) {
+      return bench(input, result);
+    }
+
+    if (!result["no-normalize"].as<bool>())
+      Renderer::set_loudness_cache(&loudness, target);
+
+    if (result.count("render-all")) {
+      return render_all_tracks(input, result["render-all"].as<string>(),
+                               result["jobs"].as<int>(), dsp, dither);
+    }
+
+    if (result.count("stems")) {
+      return render_stems(input, track, result["stems"].as<string>(),
+                          result["jobs"].as<int>(), dsp, dither);
+    }
+
+    if (result.count("render")) {
+      return render_track(input, track, result["render"].as<string>(),
+                          start_at, dsp, dither);
+    }
 
     if (SDL_Init(SDL_INIT_AUDIO) < 0) {
       cerr << "Failed to initialize SDL" << endl;
@@ -132,23 +893,72 @@ int main(int argc, const char *argv[]) {
     }
 
     // Initialize
-    if (auto err = player->init()) {
+    Player::Audio_Config config;
+    if (result.count("device"))
+      config.device = result["device"].as<string>();
+    config.sample_rate = result["rate"].as<long>();
+    config.buffer_frames = result["buffer"].as<int>();
+    config.latency_msec = result["latency"].as<int>();
+    if (config.buffer_frames < 0 || config.latency_msec < 0 ||
+        config.buffer_frames > Player::max_buffer_frames ||
+        config.sample_rate * config.latency_msec / 1000 >
+            Player::max_buffer_frames) {
+      cerr << "Invalid buffer size. Must be at most "
+           << Player::max_buffer_frames << " frames" << endl;
+      return 1;
+    }
+    config.ahead_msec = result["ahead"].as<int>();
+    config.adaptive = result["adaptive"].as<bool>();
+    config.emu_rate = result["emu-rate"].as<long>();
+    config.resample_quality = result["resample-quality"].as<int>();
+    config.realtime = result["realtime"].as<bool>();
+    config.dither = dither;
+    if (result.count("cpus")) {
+      vector<int> cpus;
+      if (!parse_list(result["cpus"].as<string>(), cpus) || cpus.size() != 2) {
+        cerr << "Invalid cores: " << result["cpus"].as<string>() << endl;
+        return 1;
+      }
+      config.render_cpu = cpus[0];
+      config.audio_cpu = cpus[1];
+    }
+    if (auto err = player->init(config)) {
       cerr << "Player error: " << err << endl;
       return 1;
     }
+    if (config.realtime)
+      print_realtime(player);
+    auto realtime_at_start = player->realtime();
+    player->set_crossfade(crossfade);
+    player->set_dsp(dsp);
+    player->set_seek_interval(result["seek-interval"].as<int>() * 1000,
+                              result["snapshots"].as<int>());
 
-    // Load file
-    if (auto err = player->load_file(input)) {
-      cerr << "Player error: " << err << endl;
+    // Queue every input, and load the first file
+    Play_Queue queue;
+    for (auto &path : inputs) {
+      if (auto err = queue.add(path)) {
+        cerr << "Player error: " << path << ": " << err << endl;
+        return 1;
+      }
+    }
+    if (queue.empty()) {
+      cerr << "Nothing to play" << endl;
+      return 1;
+    }
+    if (auto err = player->load_file(queue[0].path)) {
+      cerr << "Player error: " << queue[0].path << ": " << err << endl;
       return 1;
     }
 
-    if (track < 1 || track > player->track_count()) {
+    // Track is 0-numbered
+    Play_Queue::Position pos = queue.start(0, track - 1);
+    Play_Queue::Position next_pos = pos;
+    if (pos.track < 0 || pos.track >= player->track_count()) {
       cerr << "Invalid track number. Must be between 1 and "
            << player->track_count() << endl;
       return 1;
     }
-    track--;  // Track is 0-numbered
 
     //
     // Main loop
@@ -158,76 +968,152 @@ int main(int argc, const char *argv[]) {
     initscr();
     noecho();
     keypad(stdscr, TRUE);
-    timeout(1000);
-
-    bool playing = true;
+    nodelay(stdscr, TRUE);
 #endif
 
-    bool running = true;
-    start_track(player, track, show_info);
-
-    // If only printing info, do not keep running and exit
-    if (show_info) {
-      running = false;
-    }
+    bool playing = true;
+    bool running = play_from(player, queue, pos);
+    if (running && start_at > 0)
+      seek(player, start_at);
+    if (running)
+      prepare_next(player, queue, pos, single, next_pos);
 
     while (running) {
+      wait_events(player, playing);
+      player->clear_events();
+
 #ifdef CURSES
       // Handle input
-      int ch = getch();
-      switch (ch) {
-        case 'q':
-          running = false;
-          break;
-        case KEY_RIGHT:
-          if (track < player->track_count() - 1) {
-            track++;
-            start_track(player, track);
+      int ch;
+      while ((ch = getch()) != ERR) {
+        switch (ch) {
+          case 'q':
+            running = false;
+            break;
+          case KEY_RIGHT: {
+            Play_Queue::Position next;
+            if (queue.next(pos, player->track_count(), next)) {
+              // Usually already loaded and started in the background
+              if (!player->play_next())
+                show_track(player);
+              else if (!play_from(player, queue, next))
+                running = false;
+              pos = next;
+              if (running)
+                prepare_next(player, queue, pos, single, next_pos);
+            }
+            break;
           }
-          break;
-        case KEY_LEFT:
-          if (track > 0) {
-            track--;
+          case KEY_LEFT: {
+            Play_Queue::Position prev;
+            bool backwards = queue.prev(pos, prev);
+            if (backwards)
+              pos = prev;
+            if (play_from(player, queue, pos, backwards))
+              prepare_next(player, queue, pos, single, next_pos);
+            else
+              running = false;
+            break;
           }
-          start_track(player, track);
-          break;
-        case ' ':
-          player->pause(playing);
-          if (playing) {
-            move(0, 60);
-            PRINTF("[Paused]\n");
-            move(5, 0);
-          } else {
-            move(0, 60);
-            PRINTF("         \n");
-            move(5, 0);
-          }
-          playing = !playing;
-          break;
+          case ',':
+          case '<':
+            seek(player, player->tell() - 10000);
+            break;
+          case '.':
+          case '>':
+            seek(player, player->tell() + 10000);
+            break;
+          case '-':
+            player->set_tempo(max(player->tempo() - 0.05, 0.5));
+            break;
+          case '=':
+          case '+':
+            player->set_tempo(min(player->tempo() + 0.05, 2.0));
+            break;
+          case 'd':
+            player->set_stereo_depth(
+                player->stereo_depth() >= 1.0 ? 0.0
+                                              : player->stereo_depth() + 0.5);
+            break;
+          case 'a':
+            player->enable_accuracy(!player->accuracy());
+            break;
+          case 'e':
+            player->extend(extend_msec);
+            break;
+          case '0':
+            player->mute_voices(0);
+            break;
+          case ' ':
+            player->pause(playing);
+            if (playing) {
+              move(0, 60);
+              PRINTF("[Paused]\n");
+              move(5, 0);
+            } else {
+              move(0, 60);
+              PRINTF("         \n");
+              move(5, 0);
+            }
+            playing = !playing;
+            break;
+          default:
+            // Number keys toggle muting of each voice
+            if (ch >= '1' && ch <= '9' &&
+                ch - '1' < gme_voice_count(&player->emu()))
+              player->mute_voices(player->muted_voices() ^ (1 << (ch - '1')));
+            break;
+        }
       }
-#else
-      SDL_Delay(1000);
+      if (!running)
+        break;
 #endif
 
+      show_status(player);
+
+      // Playback moved on to the next track by itself
+      if (player->track_changed()) {
+        pos = next_pos;
+        show_track(player);
+        prepare_next(player, queue, pos, single, next_pos);
+      }
+
       // If track ended, play the next track
       if (player->track_ended()) {
         // If all tracks have been played, exit
-        if (single || track == player->track_count() - 1) {
+        Play_Queue::Position next;
+        if (single || !queue.next(pos, player->track_count(), next)) {
           running = false;
           break;
         }
 
-        track++;
-        start_track(player, track);
+        pos = next;
+        if (!play_from(player, queue, pos)) {
+          running = false;
+          break;
+        }
+        prepare_next(player, queue, pos, single, next_pos);
       }
     }
 
-    delete player;
-
 #ifdef CURSES
     endwin();
+    if (!last_error.empty())
+      fprintf(stderr, "%s\n", last_error.c_str());
 #endif
 
+    if (result.count("stats"))
+      dump_stats(player);
+
+    if (config.realtime)
+      print_realtime_lost(player, realtime_at_start);
+
+    delete player;
+
+    // Debug builds fail if the audio path allocated or locked
+    if (tripwire_report())
+      return 3;
+
     return 0;
 
   } catch (const cxxopts::OptionException &e) {
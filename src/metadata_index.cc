@@ -0,0 +1,474 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metadata_index.h"
+#include "renderer.h"
+#include "rom_image.h"
+#include "track_cache.h"
+#include "work_queue.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+using namespace std;
+
+// On-disk layout, in host byte order: header, file records sorted by path,
+// track records, then the string table. Records refer to strings by offset
+// into the table; offset 0 is the empty string.
+static const char index_magic[8] = {'N', 'S', 'F', 'P', 'I', 'D', 'X', 0};
+static const uint32_t index_version = 2;
+
+// File_Record flags
+static const uint32_t file_failed = 1;
+
+struct Metadata_Index::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t file_count;
+  uint32_t track_count;
+  uint32_t strings_size;
+  uint32_t reserved[2];
+};
+
+struct Metadata_Index::File_Record {
+  int64_t size;
+  int64_t mtime;
+  int64_t m3u_size;
+  int64_t m3u_mtime;
+  uint64_t hash;
+  uint32_t path, system, game, author, copyright, comment, dumper;
+  uint32_t first_track;
+  uint32_t track_count;
+  uint32_t flags;
+};
+
+struct Metadata_Index::Track_Record {
+  uint32_t song;
+  int32_t length, intro_length, loop_length, play_length;
+};
+
+static string str(const char *s) { return s ? s : ""; }
+
+// Size and mtime of the m3u playlist that goes with path, or -1 if none
+static void m3u_identity(const string &path, long long &size,
+                         long long &mtime) {
+  struct stat st;
+  if (stat(Renderer::m3u_path(path).c_str(), &st) || !S_ISREG(st.st_mode)) {
+    size = mtime = -1;
+  } else {
+    size = st.st_size;
+    mtime = st.st_mtime;
+  }
+}
+
+gme_err_t File_Metadata::read(const string &file_path) {
+  path = file_path;
+  string real_path;
+  if (!file_identity(path, real_path, size, mtime))
+    return "Couldn't open file";
+  m3u_identity(path, m3u_size, m3u_mtime);
+
+  // Keep the image mapped, so the renderer below loads from it too
+  shared_ptr<const Rom_Image> image;
+  RETURN_ERR(Rom_Image::open(path, image));
+  hash = image->hash();
+
+  Renderer renderer;
+  RETURN_ERR(renderer.load_file(path));
+
+  tracks.clear();
+  for (int i = 0; i < renderer.track_count(); i++) {
+    gme_info_t *info;
+    RETURN_ERR(gme_track_info(renderer.emu(), &info, i));
+    if (i == 0) {
+      system = str(info->system);
+      game = str(info->game);
+      author = str(info->author);
+      copyright = str(info->copyright);
+      comment = str(info->comment);
+      dumper = str(info->dumper);
+    }
+    Track t;
+    t.song = str(info->song);
+    t.length = info->length;
+    t.intro_length = info->intro_length;
+    t.loop_length = info->loop_length;
+    t.play_length = info->play_length;
+    tracks.push_back(t);
+    gme_free_info(info);
+  }
+  return 0;
+}
+
+Metadata_Index::Metadata_Index()
+    : data_(nullptr), size_(0), header_(nullptr), files_(nullptr),
+      tracks_(nullptr), strings_(nullptr) {}
+
+Metadata_Index::~Metadata_Index() { close(); }
+
+gme_err_t Metadata_Index::open(const string &path) {
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return 0;
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < (off_t)sizeof(Header)) {
+    ::close(fd);
+    return "Invalid index file";
+  }
+  void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED)
+    return "Couldn't map index file";
+  data_ = data;
+  size_ = st.st_size;
+
+  const Header *h = (const Header *)data_;
+  size_t expected = sizeof(Header) + h->file_count * sizeof(File_Record) +
+                    h->track_count * sizeof(Track_Record) + h->strings_size;
+  if (memcmp(h->magic, index_magic, sizeof(index_magic)) ||
+      h->version != index_version || expected != size_ ||
+      h->strings_size == 0) {
+    close();
+    return "Invalid index file";
+  }
+
+  const char *p = (const char *)data_ + sizeof(Header);
+  files_ = (const File_Record *)p;
+  p += h->file_count * sizeof(File_Record);
+  tracks_ = (const Track_Record *)p;
+  p += h->track_count * sizeof(Track_Record);
+  strings_ = p;
+  header_ = h;
+
+  // Check references once, so lookups don't have to
+  bool valid = strings_[h->strings_size - 1] == 0;
+  for (uint32_t i = 0; valid && i < h->file_count; i++)
+    valid = files_[i].first_track <= h->track_count &&
+            files_[i].track_count <= h->track_count - files_[i].first_track;
+  if (!valid) {
+    close();
+    return "Invalid index file";
+  }
+  return 0;
+}
+
+void Metadata_Index::close() {
+  if (data_)
+    munmap(data_, size_);
+  data_ = nullptr;
+  size_ = 0;
+  header_ = nullptr;
+  files_ = nullptr;
+  tracks_ = nullptr;
+  strings_ = nullptr;
+}
+
+int Metadata_Index::file_count() const {
+  return header_ ? (int)header_->file_count : 0;
+}
+
+const char *Metadata_Index::string_at(uint32_t offset) const {
+  return offset < header_->strings_size ? strings_ + offset : "";
+}
+
+Metadata_Index::File Metadata_Index::file(int i) const {
+  const File_Record &r = files_[i];
+  File f;
+  f.path = string_at(r.path);
+  f.system = string_at(r.system);
+  f.game = string_at(r.game);
+  f.author = string_at(r.author);
+  f.copyright = string_at(r.copyright);
+  f.comment = string_at(r.comment);
+  f.dumper = string_at(r.dumper);
+  f.size = r.size;
+  f.mtime = r.mtime;
+  f.m3u_size = r.m3u_size;
+  f.m3u_mtime = r.m3u_mtime;
+  f.hash = r.hash;
+  f.failed = r.flags & file_failed;
+  f.track_count = r.track_count;
+  return f;
+}
+
+Metadata_Index::Track Metadata_Index::track(int i, int track) const {
+  const Track_Record &r = tracks_[files_[i].first_track + track];
+  Track t;
+  t.song = string_at(r.song);
+  t.length = r.length;
+  t.intro_length = r.intro_length;
+  t.loop_length = r.loop_length;
+  t.play_length = r.play_length;
+  return t;
+}
+
+int Metadata_Index::find(const string &path) const {
+  int lo = 0, hi = file_count();
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(string_at(files_[mid].path), path.c_str());
+    if (cmp == 0)
+      return mid;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return -1;
+}
+
+// Copy entry of file number i, with the identity of the file now on disk
+static void copy_entry(const Metadata_Index &index, int i, File_Metadata &m) {
+  Metadata_Index::File f = index.file(i);
+  m.hash = f.hash;
+  m.failed = f.failed;
+  m.system = f.system;
+  m.game = f.game;
+  m.author = f.author;
+  m.copyright = f.copyright;
+  m.comment = f.comment;
+  m.dumper = f.dumper;
+  m.tracks.clear();
+  for (int t = 0; t < f.track_count; t++) {
+    Metadata_Index::Track track = index.track(i, t);
+    File_Metadata::Track mt;
+    mt.song = track.song;
+    mt.length = track.length;
+    mt.intro_length = track.intro_length;
+    mt.loop_length = track.loop_length;
+    mt.play_length = track.play_length;
+    m.tracks.push_back(mt);
+  }
+}
+
+bool is_music_file(const string &name) {
+  const char *dot = strrchr(name.c_str(), '.');
+  return dot && (!strcasecmp(dot, ".nsf") || !strcasecmp(dot, ".nsfe"));
+}
+
+// Collect music files under dir, skipping hidden entries and not following
+// symlinked directories
+static void walk(const string &dir, vector<File_Metadata> &files) {
+  DIR *d = opendir(dir.c_str());
+  if (!d)
+    return;
+
+  while (struct dirent *e = readdir(d)) {
+    if (e->d_name[0] == '.')
+      continue;
+
+    string path = dir + "/" + e->d_name;
+    struct stat st;
+    if (lstat(path.c_str(), &st))
+      continue;
+    if (S_ISDIR(st.st_mode)) {
+      walk(path, files);
+      continue;
+    }
+    if (S_ISLNK(st.st_mode) && stat(path.c_str(), &st))
+      continue;
+    if (S_ISREG(st.st_mode) && is_music_file(e->d_name)) {
+      File_Metadata m;
+      m.path = path;
+      m.size = st.st_size;
+      m.mtime = st.st_mtime;
+      m3u_identity(path, m.m3u_size, m.m3u_mtime);
+      files.push_back(m);
+    }
+  }
+  closedir(d);
+}
+
+gme_err_t Metadata_Index::update(const string &dir, const string &index_path,
+                                 int jobs, Update_Result &result,
+                                 callback_t done) {
+  char root[PATH_MAX];
+  if (!realpath(dir.c_str(), root))
+    return "Couldn't open directory";
+
+  vector<File_Metadata> files;
+  walk(root, files);
+  sort(files.begin(), files.end(),
+       [](const File_Metadata &a, const File_Metadata &b) {
+         return a.path < b.path;
+       });
+
+  // A broken or outdated index is rebuilt from scratch
+  Metadata_Index old;
+  if (old.open(index_path)) {
+  } // ignore error
+
+  result.files = files.size();
+  result.reused = result.read = result.failed = 0;
+
+  // Files whose size and mtime match, and whose playlist is the same, are
+  // taken as is. If only the mtime changed, the contents hash decides,
+  // except for files that failed to load, which are loaded again.
+  vector<pair<size_t, int>> pending;
+  for (size_t i = 0; i < files.size(); i++) {
+    File_Metadata &m = files[i];
+    int j = old.find(m.path);
+    if (j >= 0) {
+      File f = old.file(j);
+      if (f.m3u_size != m.m3u_size || f.m3u_mtime != m.m3u_mtime) {
+        j = -1;
+      } else if (f.size == m.size && f.mtime == m.mtime) {
+        copy_entry(old, j, m);
+        if (m.failed)
+          result.failed++;
+        else
+          result.reused++;
+        continue;
+      }
+      if (j >= 0 && (f.size != m.size || f.failed))
+        j = -1;
+    }
+    pending.push_back(make_pair(i, j));
+  }
+
+  if (!pending.empty()) {
+    Work_Queue queue(min(jobs > 0 ? jobs : Work_Queue::core_count(),
+                         (int)pending.size()));
+    mutex result_mutex;
+
+    for (auto &p : pending) {
+      size_t i = p.first;
+      int j = p.second;
+      queue.push([&, i, j](int) {
+        File_Metadata &m = files[i];
+        shared_ptr<const Rom_Image> image;
+        if (j >= 0 && !Rom_Image::open(m.path, image) &&
+            image->hash() == old.file(j).hash) {
+          copy_entry(old, j, m);
+          lock_guard<mutex> lock(result_mutex);
+          result.reused++;
+          return;
+        }
+
+        gme_err_t err = m.read(m.path);
+        lock_guard<mutex> lock(result_mutex);
+        if (err) {
+          m.tracks.clear();
+          m.failed = true;
+          result.failed++;
+        } else {
+          result.read++;
+        }
+        if (done)
+          done(m.path, err);
+      });
+    }
+    queue.run();
+  }
+
+  old.close();
+  return write(index_path, files);
+}
+
+gme_err_t Metadata_Index::write(const string &path,
+                                const vector<File_Metadata> &files) {
+  // Strings are stored once, however many files share them
+  string strings(1, '\0');
+  unordered_map<string, uint32_t> offsets;
+  auto intern = [&](const string &s) -> uint32_t {
+    if (s.empty())
+      return 0;
+    auto it = offsets.find(s);
+    if (it != offsets.end())
+      return it->second;
+    uint32_t offset = strings.size();
+    strings.append(s.c_str(), s.size() + 1);
+    offsets[s] = offset;
+    return offset;
+  };
+
+  vector<File_Record> file_records;
+  vector<Track_Record> track_records;
+  for (auto &m : files) {
+    File_Record f;
+    memset(&f, 0, sizeof(f));
+    f.size = m.size;
+    f.mtime = m.mtime;
+    f.m3u_size = m.m3u_size;
+    f.m3u_mtime = m.m3u_mtime;
+    f.hash = m.hash;
+    f.flags = m.failed ? file_failed : 0;
+    f.path = intern(m.path);
+    f.system = intern(m.system);
+    f.game = intern(m.game);
+    f.author = intern(m.author);
+    f.copyright = intern(m.copyright);
+    f.comment = intern(m.comment);
+    f.dumper = intern(m.dumper);
+    f.first_track = track_records.size();
+    f.track_count = m.tracks.size();
+    file_records.push_back(f);
+
+    for (auto &t : m.tracks) {
+      Track_Record r;
+      r.song = intern(t.song);
+      r.length = t.length;
+      r.intro_length = t.intro_length;
+      r.loop_length = t.loop_length;
+      r.play_length = t.play_length;
+      track_records.push_back(r);
+    }
+  }
+
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, index_magic, sizeof(index_magic));
+  h.version = index_version;
+  h.file_count = file_records.size();
+  h.track_count = track_records.size();
+  h.strings_size = strings.size();
+
+  string tmp = path + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (!f)
+    return "Couldn't write index file";
+  fwrite(&h, sizeof(h), 1, f);
+  fwrite(file_records.data(), sizeof(File_Record), file_records.size(), f);
+  fwrite(track_records.data(), sizeof(Track_Record), track_records.size(), f);
+  fwrite(strings.data(), 1, strings.size(), f);
+  bool failed = ferror(f);
+  if (fclose(f) || failed || rename(tmp.c_str(), path.c_str()))
+    return "Couldn't write index file";
+  return 0;
+}
+
+string Metadata_Index::default_path(const string &dir) {
+  char root[PATH_MAX];
+  if (!realpath(dir.c_str(), root))
+    return "";
+  char name[32];
+  snprintf(name, sizeof(name), "/index-%016llx",
+           (unsigned long long)hash_bytes(root, strlen(root)));
+  return cache_dir() + name;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __METADATA_INDEX_H__
+#define __METADATA_INDEX_H__
+
+#include "common.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Metadata of a music file, as gme reports it after loading the file and its
+// m3u playlist
+struct File_Metadata {
+  struct Track {
+    std::string song;
+    long length, intro_length, loop_length, play_length;
+  };
+
+  std::string path;
+  long long size, mtime;
+  long long m3u_size, m3u_mtime; // of the m3u playlist, or -1 if none
+  uint64_t hash;
+  bool failed; // couldn't be loaded, indexed without tracks
+  std::string system, game, author, copyright, comment, dumper;
+  std::vector<Track> tracks;
+
+  File_Metadata()
+      : size(0), mtime(0), m3u_size(-1), m3u_mtime(-1), hash(0),
+        failed(false) {}
+
+  // Load file and read metadata of every track. NULL on success, otherwise
+  // error string.
+  gme_err_t read(const std::string &path);
+};
+
+// Binary index of the metadata of every NSF/NSFE file in a directory tree.
+// The index file is memory mapped and read in place: records have fixed
+// size, files are sorted by path, and strings live in a shared table.
+class Metadata_Index {
+public:
+  // Views into the mapped index, valid until it is closed
+  struct File {
+    const char *path, *system, *game, *author, *copyright, *comment, *dumper;
+    long long size, mtime;
+    long long m3u_size, m3u_mtime;
+    uint64_t hash;
+    bool failed;
+    int track_count;
+  };
+  struct Track {
+    const char *song;
+    long length, intro_length, loop_length, play_length;
+  };
+
+  // Counts of an update
+  struct Update_Result {
+    int files;   // files in the tree
+    int reused;  // unchanged files taken from the old index
+    int read;    // new or changed files loaded
+    int failed;  // files that couldn't be loaded, indexed without tracks
+  };
+
+  // Called after each file loaded during an update. Can be called from any
+  // thread, but only one call at a time.
+  typedef std::function<void(const std::string &path, gme_err_t)> callback_t;
+
+  Metadata_Index();
+  ~Metadata_Index();
+
+  // Map index file. A missing file opens as an empty index. NULL on success,
+  // otherwise error string.
+  gme_err_t open(const std::string &path);
+
+  // Unmap index file
+  void close();
+
+  // Number of files in index
+  int file_count() const;
+
+  // File number i, from 0 to file_count() - 1
+  File file(int i) const;
+
+  // Track of file number i
+  Track track(int i, int track) const;
+
+  // Number of file with given path, or -1 if not indexed
+  int find(const std::string &path) const;
+
+  // Scan dir for NSF/NSFE files and write their metadata to index_path. Files
+  // with the same size and mtime as in the existing index, or the same
+  // contents hash, are not loaded again, unless their m3u playlist changed.
+  // Files that failed to load are retried once their size or mtime change.
+  // Uses jobs threads, or one per core if 0.
+  static gme_err_t update(const std::string &dir,
+                          const std::string &index_path, int jobs,
+                          Update_Result &result, callback_t done = nullptr);
+
+  // Default index file for directory, in the user cache directory
+  static std::string default_path(const std::string &dir);
+
+private:
+  struct Header;
+  struct File_Record;
+  struct Track_Record;
+
+  void *data_;
+  size_t size_;
+  const Header *header_;
+  const File_Record *files_;
+  const Track_Record *tracks_;
+  const char *strings_;
+
+  const char *string_at(uint32_t offset) const;
+
+  // Write index file, replacing it atomically
+  static gme_err_t write(const std::string &path,
+                         const std::vector<File_Metadata> &files);
+};
+
+// True if name has an NSF or NSFE extension
+bool is_music_file(const std::string &name);
+
+#endif // __METADATA_INDEX_H__
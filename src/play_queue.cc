@@ -0,0 +1,140 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "play_queue.h"
+#include "metadata_index.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+gme_err_t Play_Queue::add(const string &input) {
+  struct stat st;
+  if (stat(input.c_str(), &st))
+    return "Couldn't open file";
+
+  if (S_ISDIR(st.st_mode)) {
+    add_directory(input);
+    return 0;
+  }
+
+  const char *dot = strrchr(input.c_str(), '.');
+  if (dot && !strcasecmp(dot, ".m3u"))
+    return add_playlist(input);
+
+  entries_.push_back(Entry{input, -1});
+  return 0;
+}
+
+void Play_Queue::add_directory(const string &dir) {
+  vector<string> files, dirs;
+
+  DIR *d = opendir(dir.c_str());
+  if (!d)
+    return;
+  while (struct dirent *e = readdir(d)) {
+    if (e->d_name[0] == '.')
+      continue;
+    string path = dir + "/" + e->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st))
+      continue;
+    if (S_ISDIR(st.st_mode))
+      dirs.push_back(path);
+    else if (S_ISREG(st.st_mode) && is_music_file(e->d_name))
+      files.push_back(path);
+  }
+  closedir(d);
+
+  sort(files.begin(), files.end());
+  sort(dirs.begin(), dirs.end());
+  for (auto &f : files)
+    entries_.push_back(Entry{f, -1});
+  for (auto &sub : dirs)
+    add_directory(sub);
+}
+
+gme_err_t Play_Queue::add_playlist(const string &path) {
+  FILE *f = fopen(path.c_str(), "r");
+  if (!f)
+    return "Couldn't open playlist";
+
+  size_t slash = path.find_last_of('/');
+  string dir = slash == string::npos ? "." : path.substr(0, slash);
+
+  char line[PATH_MAX + 256];
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = 0;
+    if (!line[0] || line[0] == '#')
+      continue;
+
+    Entry e;
+    e.track = -1;
+
+    // Extended entry: "file::TYPE,track,title,..."
+    char *sep = strstr(line, "::");
+    if (sep) {
+      *sep = 0;
+      char *comma = strchr(sep + 2, ',');
+      if (comma && atoi(comma + 1) > 0)
+        e.track = atoi(comma + 1) - 1;
+    }
+
+    e.path = line[0] == '/' ? string(line) : dir + "/" + line;
+    entries_.push_back(e);
+  }
+
+  fclose(f);
+  return 0;
+}
+
+Play_Queue::Position Play_Queue::start(size_t i, int track) const {
+  Position pos;
+  pos.entry = i;
+  pos.track = entries_[i].track >= 0 ? entries_[i].track : track;
+  return pos;
+}
+
+bool Play_Queue::next(const Position &pos, int track_count,
+                      Position &out) const {
+  if (entries_[pos.entry].track < 0 && pos.track + 1 < track_count) {
+    out.entry = pos.entry;
+    out.track = pos.track + 1;
+    return true;
+  }
+  if (pos.entry + 1 >= entries_.size())
+    return false;
+  out = start(pos.entry + 1);
+  return true;
+}
+
+bool Play_Queue::prev(const Position &pos, Position &out) const {
+  if (entries_[pos.entry].track < 0 && pos.track > 0) {
+    out.entry = pos.entry;
+    out.track = pos.track - 1;
+    return true;
+  }
+  if (pos.entry == 0)
+    return false;
+  out = start(pos.entry - 1);
+  return true;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PLAY_QUEUE_H__
+#define __PLAY_QUEUE_H__
+
+#include "common.h"
+#include <string>
+#include <vector>
+
+// Files and tracks to play, in order. Built from music files, directories
+// (every NSF/NSFE file under them, sorted by path) and m3u playlists.
+class Play_Queue {
+public:
+  // A whole file, or a single track of it if track is not -1
+  struct Entry {
+    std::string path;
+    int track;
+  };
+
+  // Entry and track being played
+  struct Position {
+    size_t entry;
+    int track;
+  };
+
+  // Add music file, directory or m3u playlist. Playlist lines are file names
+  // relative to the playlist, optionally in extended form
+  // "file.nsf::NSF,track,..." with track numbered from 1. NULL on success,
+  // otherwise error string.
+  gme_err_t add(const std::string &input);
+
+  size_t size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+  const Entry &operator[](size_t i) const { return entries_[i]; }
+
+  // First position of entry i, starting whole files at track
+  Position start(size_t i, int track = 0) const;
+
+  // Position after pos, where track_count is the number of tracks in pos's
+  // file. False at the end of the queue.
+  bool next(const Position &pos, int track_count, Position &out) const;
+
+  // Position before pos. Previous entries start at their first track. False
+  // at the start of the queue.
+  bool prev(const Position &pos, Position &out) const;
+
+private:
+  std::vector<Entry> entries_;
+
+  void add_directory(const std::string &dir);
+  gme_err_t add_playlist(const std::string &path);
+};
+
+#endif // __PLAY_QUEUE_H__
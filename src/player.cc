@@ -15,209 +15,951 @@
  */
 
 #include "player.h"
+#include "quantizer.h"
+#include "realtime.h"
+#include "tripwire.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <cstring>
+#include <fcntl.h>
 #include <string>
+#include <unistd.h>
 
 using namespace std;
 
-#define RETURN_ERR(expr)                                                       \
-  do {                                                                         \
-    gme_err_t err_ = (expr);                                                   \
-    if (err_)                                                                  \
-      return err_;                                                             \
-  } while (0)
-
 // Number of audio buffers per second. Adjust if you encounter audio skipping.
 const int fill_rate = 45;
 
-// Simple sound driver using SDL
-typedef void (*sound_callback_t)(void *data, short *out, int count);
-static const char *sound_init(long sample_rate, int buf_size, sound_callback_t,
-                              void *data);
+// Number of samples rendered at a time by the producer thread
+const int produce_block = 2048;
+
+// Adaptive mode checks the audio callback this often, and shrinks the ahead
+// depth after this long without trouble
+const long long adapt_window_ns = 250000000LL;
+const long long adapt_calm_ns = 10000000000LL;
+
+// Tempo changes are spread over this long, and muting fades the output out
+// and back in over this long each way
+const int tempo_ramp_msec = 250;
+const int mute_ramp_msec = 2;
+
+const int Player::max_buffer_frames;
+
+// SCHED_FIFO priorities in real-time mode. The audio thread must preempt the
+// render thread, which must preempt everything else.
+const int audio_priority = 80;
+const int render_priority = 70;
+
+// Current time in nanoseconds, for timing the audio path
+static long long now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Simple sound driver using SDL. The timing callback gets how long each
+// device callback took, conversion included.
+typedef void (*sound_callback_t)(void *data, float *out, int count);
+typedef void (*sound_timing_t)(void *data, long long ns);
+static const char *sound_init(const char *device, long *sample_rate,
+                              int *buf_size, int dither, sound_callback_t,
+                              sound_timing_t, void *data);
 static void sound_start();
 static void sound_stop();
 static void sound_cleanup();
 
-Player::Player() {
-  emu_ = 0;
+Player::Player()
+    : current_(0), next_ready_(false), track_changed_(false),
+      loading_(false), position_(0),
+      ahead_(0), producing_(false), render_ended_(false),
+      end_signaled_(false), underruns_(0), low_water_(SIZE_MAX) {
+  crossfade_ = 0;
+  emu_rate_ = 44100;
+  out_block_ = produce_block;
+  seek_latency_ = 0.0;
+  index_stale_ = false;
   paused = false;
-  track_info_ = nullptr;
+  stereo_depth_ = 0.0;
+  accuracy_ = false;
+  tempo_ = 1.0;
+  mute_mask_ = 0;
+  changed_ = 0;
+  extend_msec_ = 0;
+  live_depth_ = 0.0;
+  live_accuracy_ = false;
+  live_tempo_ = tempo_target_ = 1.0;
+  tempo_step_ = 0.0;
+  live_mute_ = mute_target_ = 0;
+  mute_ramp_ = mute_level_ = 44100 * mute_ramp_msec / 1000;
+  next_live_ = false;
+  realtime_ = Realtime_Report();
+  lock_error_ = nullptr;
+  priority_error_ = nullptr;
+  render_cpu_error_ = audio_cpu_error_ = nullptr;
+  render_cpu_ = audio_cpu_ = -1;
+  audio_setup_ = false;
+  idle_msec_ = 1;
+  adaptive_ = false;
+  min_ahead_ = max_ahead_ = 0;
+  adapt_underruns_ = 0;
+  adapt_time_ = calm_since_ = 0;
+  buffer_ns_ = 0;
+  buf_size_ = 0;
+  last_callback_ = 0;
+
+  // Writers must never block, and a full pipe is readable anyway
+  event_pipe_[0] = event_pipe_[1] = -1;
+  if (!pipe(event_pipe_)) {
+    for (int fd : event_pipe_) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+  }
 }
 
-gme_err_t Player::init(long rate) {
-  sample_rate = rate;
-
-  int min_size = sample_rate * 2 / fill_rate;
-  int buf_size = 512;
+gme_err_t Player::init(const Audio_Config &config) {
+  sample_rate = config.sample_rate;
+
+  // Device buffer size in frames, a power of two
+  long min_size = sample_rate * 2 / fill_rate;
+  if (config.buffer_frames > 0)
+    min_size = config.buffer_frames;
+  else if (config.latency_msec > 0)
+    min_size = sample_rate * config.latency_msec / 1000;
+  min_size = min(min_size, (long)max_buffer_frames);
+  int buf_size = 64;
   while (buf_size < min_size)
     buf_size *= 2;
 
-  return sound_init(sample_rate, buf_size, fill_buffer, this);
+  const char *device = config.device.empty() ? nullptr : config.device.c_str();
+  RETURN_ERR(sound_init(device, &sample_rate, &buf_size, config.dither,
+                        fill_buffer, record_callback, this));
+  buf_size_ = buf_size;
+
+  // Emulate at a rate of its own and convert to the device rate, if asked
+  emu_rate_ = config.emu_rate > 0 ? config.emu_rate : sample_rate;
+  RETURN_ERR(resampler_.init(emu_rate_, sample_rate, config.resample_quality,
+                             produce_block));
+  mute_ramp_ = mute_level_ = max(emu_rate_ * mute_ramp_msec / 1000, 1L);
+  out_block_ = resampler_.active() ? resampler_.max_output(produce_block)
+                                   : produce_block;
+  resampled_.assign(out_block_, 0);
+  dsp_.init(sample_rate);
+
+  // Keep at least two device buffers ahead, so the callback never has to
+  // wait for the producer
+  min_ahead_ = (size_t)buf_size * 2 * 2 + out_block_;
+  max_ahead_ = sample_rate * 2 * config.ahead_msec / 1000;
+  if (max_ahead_ < min_ahead_)
+    max_ahead_ = min_ahead_;
+  adaptive_ = config.adaptive;
+  ahead_ = adaptive_ ? min_ahead_ : max_ahead_;
+  ring_.resize(max_ahead_);
+
+  buffer_ns_ = (long long)buf_size * 1000000000 / sample_rate;
+
+  // When the ring is full, sleep for a quarter of a device buffer
+  idle_msec_ = buf_size * 1000 / sample_rate / 4;
+  if (idle_msec_ < 1)
+    idle_msec_ = 1;
+
+  if (config.realtime) {
+    realtime_.enabled = true;
+    render_cpu_ = config.render_cpu;
+    audio_cpu_ = config.audio_cpu;
+    audio_setup_ = true;
+
+    // Find out what the threads will get, on a throwaway thread. The audio
+    // thread asks for the higher priority, so that is the one to try.
+    std::thread probe([this] {
+      realtime_.scheduling = set_realtime_priority(audio_priority);
+      if (render_cpu_ >= 0)
+        realtime_.render_cpu = pin_thread(render_cpu_);
+      if (audio_cpu_ >= 0)
+        realtime_.audio_cpu = pin_thread(audio_cpu_);
+    });
+    probe.join();
+
+    // The ring and everything else allocated so far is faulted in and
+    // stays in memory. Unless the system locks later allocations too,
+    // emulators and thread stacks are locked as they come.
+    realtime_.memory = lock_memory(realtime_.memory_future);
+  }
+
+  return 0;
+}
+
+Player::Realtime_Report Player::realtime() const {
+  Realtime_Report report = realtime_;
+  if (!report.memory)
+    report.memory = lock_error_;
+  if (!report.scheduling)
+    report.scheduling = priority_error_;
+  if (!report.render_cpu)
+    report.render_cpu = render_cpu_error_;
+  if (!report.audio_cpu)
+    report.audio_cpu = audio_cpu_error_;
+  return report;
+}
+
+// Lock what was allocated since init(), such as emulators and snapshots,
+// when the system doesn't do it by itself
+void Player::lock_new_memory() {
+  if (realtime_.enabled && !realtime_.memory && !realtime_.memory_future) {
+    if (gme_err_t err = lock_current_memory())
+      lock_error_ = err;
+  }
 }
 
 void Player::stop() {
+  wait_loader();
   sound_stop();
-  gme_delete(emu_);
-  emu_ = nullptr;
+  stop_producer();
+  index_.clear();
+  renderers_[0].unload();
+  renderers_[1].unload();
+  next_ready_ = false;
 }
 
 Player::~Player() {
   stop();
   sound_cleanup();
-  gme_free_info(track_info_);
+  close(event_pipe_[0]);
+  close(event_pipe_[1]);
 }
 
 gme_err_t Player::load_file(const string &path) {
-  filename_ = path;
-
   stop();
 
-  RETURN_ERR(gme_open_file(path.c_str(), &emu_, sample_rate));
-
-  char m3u_path[256 + 5];
-  strncpy(m3u_path, path.c_str(), 256);
-  m3u_path[256] = 0;
-  char *p = strrchr(m3u_path, '.');
-  if (!p)
-    p = m3u_path + strlen(m3u_path);
-  strcpy(p, ".m3u");
-  if (gme_load_m3u(emu_, m3u_path)) {
-  } // ignore error
-
+  RETURN_ERR(cur().load_file(path, emu_rate_));
+  apply_settings(cur());
   return 0;
 }
 
-int Player::track_count() const { return emu_ ? gme_track_count(emu_) : false; }
+int Player::track_count() const { return renderer().track_count(); }
 
 gme_err_t Player::start_track(int track, bool dry_run) {
-  if (emu_) {
-    gme_free_info(track_info_);
-    track_info_ = nullptr;
-    RETURN_ERR(gme_track_info(emu_, &track_info_, track));
-
-    // Sound must not be running when operating on emulator
+  if (cur().emu()) {
+    // Sound and producer must not be running when operating on emulator
+    wait_loader();
     sound_stop();
-    RETURN_ERR(gme_start_track(emu_, track));
-
-    // Calculate track length
-    if (track_info_->length <= 0)
-      track_info_->length =
-          track_info_->intro_length + track_info_->loop_length * 2;
-
-    if (track_info_->length <= 0)
-      track_info_->length = (long)(2.5 * 60 * 1000);
-    gme_set_fade(emu_, track_info_->length);
+    stop_producer();
+    ring_.clear();
+    resampler_.clear();
+    dsp_.reset();
+    next_ready_ = false;
+    track_changed_ = false;
+    RETURN_ERR(cur().start_track(track));
+    render_ended_ = false;
+    end_signaled_ = false;
+    position_ = 0;
 
     paused = false;
 
     if (!dry_run) {
+      build_index();
+      start_producer();
       sound_start();
     }
   }
   return 0;
 }
 
+gme_err_t Player::seek(long msec) {
+  if (!cur().emu())
+    return 0;
+
+  auto start = std::chrono::steady_clock::now();
+
+  sound_stop();
+  stop_producer();
+  ring_.clear();
+  resampler_.clear();
+  dsp_.reset();
+
+  if (msec < 0)
+    msec = 0;
+
+  // Snapshots don't know the track was extended
+  long fade_start = cur().fade_start();
+  if (index_stale_)
+    build_index();
+  index_.restore(cur(), msec);
+  cur().set_fade_start(fade_start);
+  gme_err_t err = cur().seek(msec);
+  render_ended_ = false;
+  end_signaled_ = false;
+  position_ = msec;
+
+  // Producer renders its first blocks before returning, so they count
+  // towards latency too
+  if (!paused) {
+    start_producer();
+    sound_start();
+  }
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  seek_latency_ = elapsed.count();
+  return err;
+}
+
+long Player::tell() const {
+  long msec = position_ - buffered_msec();
+  return msec > 0 ? msec : 0;
+}
+
+void Player::set_seek_interval(long interval_msec, int max_count) {
+  index_.set_interval(interval_msec, max_count);
+  build_index();
+}
+
+void Player::build_index() {
+  index_stale_ = false;
+  const Renderer &r = cur();
+  if (!r.emu() || r.current_track() < 0)
+    return;
+  index_.build(r.filename(), emu_rate_, r.current_track(),
+               r.track_info().length + Renderer::fade_length(),
+               [this](Renderer &r) { apply_settings(r); },
+               [this] { lock_new_memory(); });
+}
+
 void Player::pause(int b) {
   paused = b;
-  if (b)
+  if (b) {
     sound_stop();
-  else
+    stop_producer();
+  } else {
+    start_producer();
     sound_start();
+  }
 }
 
 void Player::suspend() {
-  if (!paused)
+  if (!paused) {
     sound_stop();
+    stop_producer();
+  }
 }
 
 void Player::resume() {
-  if (!paused)
+  if (!paused) {
+    start_producer();
     sound_start();
+  }
 }
 
 bool Player::track_ended() const {
-  return emu_ ? gme_track_ended(emu_) : false;
+  return render_ended_ && ring_.size() == 0;
+}
+
+void Player::prepare_next(const string &path, int track) {
+  if (next_ready_ || render_ended_ || loading_)
+    return;
+
+  // Join the previous loader, which is already done
+  wait_loader();
+
+  loading_ = true;
+  loader_ = std::thread([this, path, track] {
+    Renderer &r = next();
+    gme_err_t err = 0;
+    if (!r.emu() || r.filename() != path) {
+      err = r.load_file(path, emu_rate_);
+      if (!err)
+        apply_settings(r);
+    }
+    if (!err)
+      err = r.start_track(track);
+    lock_new_memory();
+
+    // Hand it over to the producer
+    if (!err) {
+      next_live_ = false;
+      next_ready_ = true;
+    }
+    loading_ = false;
+  });
+}
+
+void Player::wait_loader() {
+  if (loader_.joinable())
+    loader_.join();
+}
+
+gme_err_t Player::play_next() {
+  wait_loader();
+  sound_stop();
+  stop_producer();
+
+  // Producer may have moved on to it already
+  if (!next_ready_) {
+    if (!paused) {
+      start_producer();
+      sound_start();
+    }
+    return "No next track prepared";
+  }
+
+  // Restart it if the crossfade already began playing it
+  Renderer &r = next();
+  if (r.tell() > 0)
+    RETURN_ERR(r.start_track(r.current_track()));
+
+  ring_.clear();
+  resampler_.clear();
+  dsp_.reset();
+  current_ = 1 - current_;
+  next_ready_ = false;
+  track_changed_ = false;
+  render_ended_ = false;
+  end_signaled_ = false;
+  position_ = 0;
+  paused = false;
+
+  build_index();
+  start_producer();
+  sound_start();
+  return 0;
+}
+
+bool Player::track_changed() {
+  if (!track_changed_.exchange(false))
+    return false;
+
+  // Snapshots of the previous track are no use anymore
+  build_index();
+  return true;
+}
+
+void Player::signal_event() {
+  char c = 0;
+  if (write(event_pipe_[1], &c, 1)) {
+  } // ignore error, the pipe is already readable if full
+}
+
+void Player::clear_events() {
+  char buf[64];
+  while (read(event_pipe_[0], buf, sizeof(buf)) > 0)
+    ;
 }
 
-void Player::set_stereo_depth(double tempo) {
+void Player::set_dsp(const Dsp_Chain &dsp) {
   suspend();
-  gme_set_stereo_depth(emu_, tempo);
+  dsp_ = dsp;
+  dsp_.init(sample_rate);
   resume();
 }
 
-void Player::enable_accuracy(bool b) {
+void Player::set_crossfade(int msec) {
   suspend();
-  gme_enable_accuracy(emu_, b);
+  crossfade_ = emu_rate_ * 2 * msec / 1000;
   resume();
 }
 
+void Player::apply_settings(Renderer &r) {
+  if (!r.emu())
+    return;
+  gme_set_stereo_depth(r.emu(), stereo_depth_);
+  gme_enable_accuracy(r.emu(), accuracy_);
+  gme_set_tempo(r.emu(), tempo_);
+  gme_mute_voices(r.emu(), mute_mask_);
+  gme_ignore_silence(r.emu(), mute_mask_ != 0);
+}
+
+void Player::apply_live(Renderer &r) {
+  if (!r.emu())
+    return;
+  gme_set_stereo_depth(r.emu(), live_depth_);
+  gme_enable_accuracy(r.emu(), live_accuracy_);
+  gme_set_tempo(r.emu(), live_tempo_);
+  gme_mute_voices(r.emu(), live_mute_);
+  gme_ignore_silence(r.emu(), live_mute_ != 0);
+}
+
+int Player::buffered_msec() const {
+  return ring_.size() * 1000 / (sample_rate * 2);
+}
+
+int Player::ahead_msec() const { return ahead_ * 1000 / (sample_rate * 2); }
+
+void Player::start_producer() {
+  if (producing_)
+    return;
+
+  // Changes made while stopped take effect at once, with no ramp
+  settle();
+
+  // Files, tracks and post-processing are only changed while stopped
+  lock_new_memory();
+
+  // Have something ready before the device asks for it
+  fill_ring();
+
+  // Device is stopped, so the next callback interval means nothing
+  last_callback_ = 0;
+  low_water_ = SIZE_MAX;
+  adapt_underruns_ = underruns_;
+  adapt_time_ = calm_since_ = now_ns();
+
+  producing_ = true;
+  producer_ = std::thread(&Player::produce, this);
+}
+
+void Player::stop_producer() {
+  if (!producing_)
+    return;
+
+  producing_ = false;
+  producer_.join();
+}
+
+void Player::fill_ring() {
+  float buf[produce_block];
+  while (!render_ended_ && ring_.size() + out_block_ <= ahead_) {
+    Renderer &r = cur();
+
+    run_changes();
+    if (next_ready_ && !next_live_) {
+      apply_live(next());
+      next_live_ = true;
+    }
+
+    // Stop exactly at the end of the track, or at the start of the
+    // crossfade, so blocks never straddle a boundary
+    long remaining = r.track_samples() - r.tell();
+    long fade_start = remaining - crossfade_;
+    int count = produce_block;
+    if (fade_start > 0 && fade_start < count)
+      count = fade_start;
+    else if (remaining < count)
+      count = remaining > 0 ? remaining : 0;
+    count = ramp_settings(count);
+
+    render_block(buf, count);
+    fade_mute(buf, count);
+    float *out = buf;
+    if (resampler_.active()) {
+      out = resampled_.data();
+      count = resampler_.process(buf, count, out, out_block_);
+    }
+    dsp_.process(out, count);
+    ring_.write(out, count);
+    position_ = cur().tell() * 1000 / (emu_rate_ * 2);
+
+    if (r.track_ended() || r.tell() >= r.track_samples()) {
+      if (next_ready_) {
+        // Next renderer already played the crossfade, if any
+        current_ = 1 - current_;
+        next_ready_ = false;
+        track_changed_ = true;
+        signal_event();
+      } else {
+        render_ended_ = true;
+      }
+    }
+  }
+}
+
+void Player::render_block(float *out, int count) {
+  Renderer &r = cur();
+  long start = r.track_samples() - crossfade_;
+  long pos = r.tell();
+
+  // Everything after the emulator runs in float, with headroom
+  long long t = now_ns();
+  if (r.play(count, out)) {
+  } // ignore error
+  stats_.render.record(now_ns() - t);
+
+  if (!next_ready_ || pos < start || crossfade_ <= 0)
+    return;
+
+  // Inside crossfade: fade current out and next in
+  float in[produce_block];
+  t = now_ns();
+  if (next().play(count, in)) {
+  } // ignore error
+  stats_.render.record(now_ns() - t);
+
+  for (int i = 0; i < count; i += 2) {
+    float g = (float)(pos - start + i) / crossfade_;
+    for (int c = 0; c < 2; c++)
+      out[i + c] = out[i + c] * (1.0f - g) + in[i + c] * g;
+  }
+}
+
+void Player::setup_thread(int priority, int cpu,
+                          std::atomic<gme_err_t> &cpu_error) {
+  // What init() found may have changed since, or not hold for this thread
+  if (gme_err_t err = set_realtime_priority(priority))
+    priority_error_ = err;
+  if (cpu >= 0) {
+    if (gme_err_t err = pin_thread(cpu))
+      cpu_error = err;
+  }
+
+  // New threads get new stacks, locked here unless the system does it
+  gme_err_t err = prefault_stack();
+  if (err && !realtime_.memory && !realtime_.memory_future)
+    lock_error_ = err;
+}
+
+void Player::produce() {
+  if (realtime_.enabled)
+    setup_thread(render_priority, render_cpu_, render_cpu_error_);
+
+  while (producing_) {
+    // Only steady rendering, not the fill that primes the ring
+    {
+      Tripwire_Scope scope;
+      fill_ring();
+    }
+    if (adaptive_)
+      adapt();
+    std::this_thread::sleep_for(std::chrono::milliseconds(idle_msec_));
+  }
+}
+
+// Double the ahead depth whenever the callback ran dry or came within a
+// quarter buffer of it, and give back a quarter of it after a calm period
+void Player::adapt() {
+  long long now = now_ns();
+  if (now - adapt_time_ < adapt_window_ns)
+    return;
+  adapt_time_ = now;
+
+  size_t low = low_water_.exchange(SIZE_MAX);
+  size_t margin = (size_t)buf_size_ * 2 * 5 / 4;
+  long underruns = underruns_;
+  bool struggling = underruns != adapt_underruns_ || low < margin;
+  adapt_underruns_ = underruns;
+
+  size_t ahead = ahead_;
+  if (struggling) {
+    calm_since_ = now;
+    ahead_ = ahead * 2 < max_ahead_ ? ahead * 2 : max_ahead_;
+  } else if (now - calm_since_ >= adapt_calm_ns && ahead > min_ahead_) {
+    calm_since_ = now;
+    ahead -= ahead / 4;
+    ahead_ = ahead > min_ahead_ ? ahead : min_ahead_;
+  }
+}
+
+void Player::set_stereo_depth(double depth) {
+  stereo_depth_ = depth;
+  post_change(change_stereo_depth);
+}
+
+void Player::enable_accuracy(bool b) {
+  accuracy_ = b;
+  post_change(change_accuracy);
+}
+
 void Player::set_tempo(double tempo) {
-  suspend();
-  gme_set_tempo(emu_, tempo);
-  resume();
+  tempo_ = tempo;
+  post_change(change_tempo);
+
+  // Snapshots taken at the old tempo are at the wrong places now. Rebuild
+  // them on the next seek, not on every step of a tempo change.
+  index_.clear();
+  index_stale_ = true;
 }
 
 void Player::mute_voices(int mask) {
-  suspend();
-  gme_mute_voices(emu_, mask);
-  gme_ignore_silence(emu_, mask != 0);
-  resume();
+  mute_mask_ = mask;
+  post_change(change_mute);
 }
 
-void Player::fill_buffer(void *data, sample_t *out, int count) {
+void Player::extend(long msec) { extend_msec_ += msec; }
+
+void Player::post_change(unsigned change) {
+  // The new value is stored first, so the producer never sees the flag
+  // without it. Changes made before the producer gets to them coalesce.
+  changed_ |= change;
+}
+
+// Emulators of the playing renderers: the current one, and the next one
+// once it has the live settings. Returns how many there are.
+int Player::live_emus(Music_Emu *out[2]) {
+  int n = 0;
+  if (cur().emu())
+    out[n++] = cur().emu();
+  if (next_ready_ && next_live_ && next().emu())
+    out[n++] = next().emu();
+  return n;
+}
+
+void Player::run_changes() {
+  unsigned changed = changed_.exchange(0);
+  long extend_msec = extend_msec_.exchange(0);
+  if (!changed && !extend_msec)
+    return;
+
+  Music_Emu *emus[2];
+  int n = live_emus(emus);
+  if (changed & change_stereo_depth) {
+    live_depth_ = stereo_depth_;
+    for (int i = 0; i < n; i++)
+      gme_set_stereo_depth(emus[i], live_depth_);
+  }
+  if (changed & change_accuracy) {
+    live_accuracy_ = accuracy_;
+    for (int i = 0; i < n; i++)
+      gme_enable_accuracy(emus[i], live_accuracy_);
+  }
+  if (changed & change_tempo) {
+    tempo_target_ = tempo_;
+    tempo_step_ = fabs(tempo_target_ - live_tempo_) * produce_block /
+                  (emu_rate_ * 2 * tempo_ramp_msec / 1000.0);
+  }
+  if (changed & change_mute)
+    mute_target_ = mute_mask_;
+  if (extend_msec)
+    extend_live(extend_msec);
+}
+
+// Move the fade out of the current track msec later than where it is, or
+// than now if it already started. Too late once a crossfade started.
+void Player::extend_live(long msec) {
+  Renderer &r = cur();
+  if (next_ready_ && crossfade_ > 0 &&
+      r.tell() >= r.track_samples() - crossfade_)
+    return;
+  long from = max(r.fade_start(), r.tell());
+  r.set_fade_start(from + msec * emu_rate_ / 1000 * 2);
+}
+
+void Player::settle() {
+  // Settings are caught up with below, extensions can't be
+  changed_ = 0;
+  if (long extend_msec = extend_msec_.exchange(0))
+    extend_live(extend_msec);
+  live_depth_ = stereo_depth_;
+  live_accuracy_ = accuracy_;
+  live_tempo_ = tempo_target_ = tempo_;
+  live_mute_ = mute_target_ = mute_mask_;
+  mute_level_ = mute_ramp_;
+  apply_live(cur());
+  if (next_ready_)
+    next_live_ = false;
+}
+
+// Move tempo a step closer to its target, and switch voice mutes once the
+// output has faded out. Returns count, shortened so a fade out ends exactly
+// at the end of the block.
+int Player::ramp_settings(int count) {
+  Music_Emu *emus[2];
+  int n = live_emus(emus);
+
+  if (live_tempo_ != tempo_target_) {
+    if (live_tempo_ < tempo_target_)
+      live_tempo_ = min(live_tempo_ + tempo_step_, tempo_target_);
+    else
+      live_tempo_ = max(live_tempo_ - tempo_step_, tempo_target_);
+    for (int i = 0; i < n; i++)
+      gme_set_tempo(emus[i], live_tempo_);
+  }
+
+  if (live_mute_ != mute_target_) {
+    if (mute_level_ > 0)
+      return min(count, mute_level_ * 2);
+
+    live_mute_ = mute_target_;
+    for (int i = 0; i < n; i++) {
+      gme_mute_voices(emus[i], live_mute_);
+      gme_ignore_silence(emus[i], live_mute_ != 0);
+    }
+  }
+  return count;
+}
+
+void Player::fade_mute(float *out, int count) {
+  if (live_mute_ == mute_target_ && mute_level_ == mute_ramp_)
+    return;
+
+  for (int i = 0; i < count; i += 2) {
+    if (live_mute_ != mute_target_)
+      mute_level_ = max(mute_level_ - 1, 0);
+    else
+      mute_level_ = min(mute_level_ + 1, mute_ramp_);
+    float g = (float)mute_level_ / mute_ramp_;
+    out[i] = out[i] * g;
+    out[i + 1] = out[i + 1] * g;
+  }
+}
+
+// Runs on the audio thread, so it must not allocate or page fault: it only
+// touches the ring, the stats and its own fields, all allocated by init()
+// and locked in real-time mode. The one system call is the write() to the
+// event pipe when the track ends.
+void Player::fill_buffer(void *data, float *out, int count) {
   Player *self = (Player *)data;
-  if (self->emu_) {
-    if (gme_play(self->emu_, count, out)) {
-    } // ignore error
+  if (self->audio_setup_) {
+    self->audio_setup_ = false;
+    self->setup_thread(audio_priority, self->audio_cpu_,
+                       self->audio_cpu_error_);
+  }
+  Tripwire_Scope scope;
+  long long start = now_ns();
+
+  if (self->last_callback_) {
+    long long interval = start - self->last_callback_;
+    self->stats_.interval.record(interval);
+    if (interval > self->buffer_ns_ * 3 / 2)
+      self->stats_.late++;
+  }
+  self->last_callback_ = start;
+
+  size_t level = self->ring_.size();
+  size_t low = self->low_water_.load(std::memory_order_relaxed);
+  while (level < low && !self->low_water_.compare_exchange_weak(low, level))
+    ;
+
+  int n = self->ring_.read(out, count);
+  if (n < count) {
+    memset(out + n, 0, (count - n) * sizeof(float));
+    if (!self->render_ended_)
+      self->underruns_++;
+    else if (!self->end_signaled_.exchange(true))
+      self->signal_event();
   }
 }
 
+void Player::record_callback(void *data, long long ns) {
+  ((Player *)data)->stats_.callback.record(ns);
+}
+
 // Sound output driver using SDL
 
 #include "SDL2/SDL.h"
+#include <vector>
 
 static sound_callback_t sound_callback;
+static sound_timing_t sound_timing;
 static void *sound_callback_data;
+static SDL_AudioDeviceID sound_device;
+static SDL_AudioSpec sound_spec;
+static std::vector<float> sound_buf;
+static Quantizer sound_quantizer;
 
 static void sdl_callback(void *data, Uint8 *out, int count) {
   if (data) {
   }; // ignore unused variable warning
-  if (sound_callback)
-    sound_callback(sound_callback_data, (short *)out, count / 2);
+  if (!sound_callback)
+    return;
+  long long start = now_ns();
+
+  if (sound_spec.format == AUDIO_F32SYS) {
+    // Float devices take the output as it is, within full scale
+    sound_callback(sound_callback_data, (float *)out, count / 4);
+    sound_quantizer.to_f32((float *)out, (float *)out, count / 4);
+  } else {
+    int samples = count / (SDL_AUDIO_BITSIZE(sound_spec.format) / 8);
+    if (samples > (int)sound_buf.size())
+      samples = sound_buf.size();
+    sound_callback(sound_callback_data, sound_buf.data(), samples);
+    if (sound_spec.format == AUDIO_S32SYS)
+      sound_quantizer.to_s32(sound_buf.data(), (int32_t *)out, samples);
+    else
+      sound_quantizer.to_s16(sound_buf.data(), (short *)out, samples);
+  }
+
+  if (sound_timing)
+    sound_timing(sound_callback_data, now_ns() - start);
+}
+
+static const char *sound_error() {
+  const char *err = SDL_GetError();
+  if (!err || !*err)
+    err = "Couldn't open SDL audio";
+  return err;
 }
 
-static const char *sound_init(long sample_rate, int buf_size,
-                              sound_callback_t cb, void *data) {
+static const char *sound_init(const char *device, long *sample_rate,
+                              int *buf_size, int dither, sound_callback_t cb,
+                              sound_timing_t timing, void *data) {
   sound_callback = cb;
+  sound_timing = timing;
   sound_callback_data = data;
+  sound_quantizer.set_dither(dither);
 
-  static SDL_AudioSpec as; // making static clears all fields to 0
-  as.freq = sample_rate;
-  as.format = AUDIO_S16SYS;
+  SDL_AudioSpec as;
+  SDL_memset(&as, 0, sizeof(as));
+  as.freq = *sample_rate;
+  as.format = AUDIO_F32SYS;
   as.channels = 2;
   as.callback = sdl_callback;
-  as.samples = buf_size;
-  if (SDL_OpenAudio(&as, 0) < 0) {
-    const char *err = SDL_GetError();
-    if (!err)
-      err = "Couldn't open SDL audio";
-    return err;
+  as.samples = *buf_size;
+
+  // Take whatever rate, format and buffer size the device prefers, so SDL
+  // doesn't have to resample or convert. Float is asked for, so output can
+  // go straight to the device. Formats other than these are left to SDL.
+  int allowed = SDL_AUDIO_ALLOW_FREQUENCY_CHANGE |
+                SDL_AUDIO_ALLOW_FORMAT_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE;
+  sound_device = SDL_OpenAudioDevice(device, 0, &as, &sound_spec, allowed);
+  if (sound_device && sound_spec.format != AUDIO_S16SYS &&
+      sound_spec.format != AUDIO_S32SYS && sound_spec.format != AUDIO_F32SYS) {
+    SDL_CloseAudioDevice(sound_device);
+    allowed &= ~SDL_AUDIO_ALLOW_FORMAT_CHANGE;
+    sound_device = SDL_OpenAudioDevice(device, 0, &as, &sound_spec, allowed);
   }
+  if (!sound_device)
+    return sound_error();
 
+  sound_buf.assign(sound_spec.samples * sound_spec.channels, 0);
+  *sample_rate = sound_spec.freq;
+  *buf_size = sound_spec.samples;
   return 0;
 }
 
-static void sound_start() { SDL_PauseAudio(false); }
+static const char *sound_format() {
+  switch (sound_spec.format) {
+  case AUDIO_S16SYS:
+    return "s16";
+  case AUDIO_S32SYS:
+    return "s32";
+  case AUDIO_F32SYS:
+    return "f32";
+  }
+  return "?";
+}
+
+static void sound_start() {
+  if (sound_device)
+    SDL_PauseAudioDevice(sound_device, false);
+}
 
 static void sound_stop() {
-  SDL_PauseAudio(true);
+  if (!sound_device)
+    return;
+
+  SDL_PauseAudioDevice(sound_device, true);
 
   // be sure audio thread is not active
-  SDL_LockAudio();
-  SDL_UnlockAudio();
+  SDL_LockAudioDevice(sound_device);
+  SDL_UnlockAudioDevice(sound_device);
 }
 
 static void sound_cleanup() {
   sound_stop();
-  SDL_CloseAudio();
+  if (sound_device)
+    SDL_CloseAudioDevice(sound_device);
+  sound_device = 0;
 }
+
+std::vector<std::string> Player::devices() {
+  std::vector<std::string> names;
+  int count = SDL_GetNumAudioDevices(0);
+  for (int i = 0; i < count; i++) {
+    const char *name = SDL_GetAudioDeviceName(i, 0);
+    if (name)
+      names.push_back(name);
+  }
+  return names;
+}
+
+const char *Player::device_format() const { return sound_format(); }
@@ -17,18 +17,80 @@
 #ifndef __PLAYER_H__
 #define __PLAYER_H__
 
-#include "gme/gme.h"
+#include "dsp_chain.h"
+#include "histogram.h"
+#include "quantizer.h"
+#include "renderer.h"
+#include "resampler.h"
+#include "ring_buffer.h"
+#include "seek_index.h"
+#include <atomic>
 #include <string>
+#include <thread>
+#include <vector>
 
-typedef short sample_t;
+// Timing of the audio path, recorded from the audio and producer threads
+struct Audio_Stats {
+  Histogram callback; // time spent in each audio callback, including the
+                      // conversion to the device format
+  Histogram interval; // time between the start of consecutive callbacks
+  Histogram render;   // time spent in gme_play for each rendered block
+  std::atomic<long> late; // callbacks that came more than 1.5 buffers late
+
+  Audio_Stats() : late(0) {}
+};
 
 class Player {
 public:
   Player();
   ~Player();
 
-  // Initialize player and set sample rate
-  gme_err_t init(long sample_rate = 44100);
+  // Largest device buffer, in frames. SDL keeps the size in 16 bits.
+  static const int max_buffer_frames = 32768;
+
+  // Audio device settings
+  struct Audio_Config {
+    std::string device; // device name, or empty for the default one
+    long sample_rate;   // requested rate, the device may choose another
+    int buffer_frames;  // device buffer size, or 0 to use latency_msec,
+                        // up to max_buffer_frames
+    int latency_msec;   // device buffer duration, or 0 for the default
+    int ahead_msec;     // audio rendered ahead of playback
+    bool adaptive;      // start with little audio ahead and adjust it to
+                        // underruns, up to ahead_msec
+    long emu_rate;      // emulation rate, or 0 to emulate at the device rate
+    int resample_quality; // Resampler quality when the rates differ
+    bool realtime;      // real-time priority for the render and audio
+                        // threads, and locked memory
+    int render_cpu;     // core to pin the render thread to, or -1
+    int audio_cpu;      // core to pin the audio thread to, or -1
+    int dither;         // Quantizer dither for integer devices
+
+    Audio_Config()
+        : sample_rate(44100), buffer_frames(0), latency_msec(0),
+          ahead_msec(200), adaptive(false), emu_rate(0),
+          resample_quality(Resampler::quality_medium), realtime(false),
+          render_cpu(-1), audio_cpu(-1), dither(Quantizer::dither_none) {}
+  };
+
+  // Real-time guarantees obtained. Each error is NULL if the guarantee was
+  // obtained, or says why not.
+  struct Realtime_Report {
+    bool enabled;
+    gme_err_t memory;     // locking memory, including what was loaded and
+                          // the thread stacks created since init()
+    bool memory_future;   // memory mapped later is locked by the system;
+                          // otherwise nsfp locks it again after each load
+    gme_err_t scheduling; // SCHED_FIFO for the render and audio threads
+    gme_err_t render_cpu; // pinning the render thread, if asked
+    gme_err_t audio_cpu;  // pinning the audio thread, if asked
+  };
+
+  // Open audio device and initialize player
+  gme_err_t init(const Audio_Config &config = Audio_Config());
+
+  // Names of available audio devices. SDL audio must be initialized.
+  static std::vector<std::string> devices();
 
   // Load game music file. NULL on success, otherwise error string.
   gme_err_t load_file(const std::string &path);
@@ -39,50 +101,254 @@ public:
   // Stop playing current file
   void stop();
 
+  // Jump to msec milliseconds into current track
+  gme_err_t seek(long msec);
+
+  // Milliseconds into current track being played right now
+  long tell() const;
+
   //
   // Optional functions
   //
 
   // Return currently loaded filename
-  const std::string &filename() const { return filename_; }
+  const std::string &filename() const { return renderer().filename(); }
 
   // Number of tracks in current file, or 0 if no file loaded.
   int track_count() const;
 
   // Info for current track
-  gme_info_t const &track_info() const { return *track_info_; }
+  gme_info_t const &track_info() const { return renderer().track_info(); }
 
   // Pause/resume playing current track.
   void pause(int);
 
-  // True if track ended
+  // True if track ended and there is no next track to continue with
   bool track_ended() const;
 
+  // Start track of file after the current one ends, without stopping the
+  // audio device. The file is loaded and the track started on a background
+  // thread, so this never blocks. Does nothing if a next track is already
+  // prepared or being prepared.
+  void prepare_next(const std::string &path, int track);
+
+  // Switch to the prepared next track right away. Fails if no next track
+  // was prepared, and then playback goes on unchanged.
+  gme_err_t play_next();
+
+  // True once after playback moved on to the prepared next track
+  bool track_changed();
+
+  // Descriptor that becomes readable, for poll(), when playback moves on to
+  // the next track or the track ends. Call clear_events() after waking up.
+  int event_fd() const { return event_pipe_[0]; }
+
+  // Consume pending notifications on event_fd()
+  void clear_events();
+
+  // Take a seek snapshot every interval_msec milliseconds of each track,
+  // keeping at most max_count of them in memory
+  void set_seek_interval(long interval_msec, int max_count);
+
+  // Snapshots used for seeking in current track
+  const Seek_Index &seek_index() const { return index_; }
+
+  // Wall time taken by the last seek, in milliseconds
+  double seek_latency() const { return seek_latency_; }
+
+  // Post-process audio with a copy of dsp, at the device rate
+  void set_dsp(const Dsp_Chain &dsp);
+
+  // Mix the end of each track with the start of the next one for msec
+  // milliseconds. 0 means plain gapless playback.
+  void set_crossfade(int msec);
+
   // Pointer to emulator
-  Music_Emu &emu() const { return *emu_; }
+  Music_Emu &emu() const { return *renderer().emu(); }
+
+  // Renderer feeding the audio device
+  const Renderer &renderer() const { return renderers_[current_]; }
+
+  // Milliseconds of audio rendered ahead and waiting to be played
+  int buffered_msec() const;
+
+  // Maximum milliseconds of audio rendered ahead. In adaptive mode it changes
+  // while playing.
+  int ahead_msec() const;
+
+  // Number of times the audio device asked for more audio than was ready
+  long underruns() const { return underruns_; }
+
+  // Timing of audio callbacks and rendering
+  const Audio_Stats &stats() const { return stats_; }
+
+  // Duration of one audio device buffer, in nanoseconds
+  long buffer_ns() const { return buffer_ns_; }
+
+  // Sample rate, buffer size (in frames) and sample format negotiated with
+  // the audio device
+  long device_rate() const { return sample_rate; }
+  long emu_rate() const { return emu_rate_; }
+  int device_buffer() const { return buf_size_; }
+  const char *device_format() const;
+
+  // What real-time mode obtained so far
+  Realtime_Report realtime() const;
+
+  // Live settings. These never stop the audio device: each change is picked
+  // up by the producer thread, which applies it between two blocks. Tempo
+  // ramps to its new value, and muting briefly dips the output so voices
+  // don't click in or out.
 
   // Set stereo depth, where 0.0 = none and 1.0 = maximum
   void set_stereo_depth(double);
+  double stereo_depth() const { return stereo_depth_; }
 
   // Enable accurate sound emulation
   void enable_accuracy(bool);
+  bool accuracy() const { return accuracy_; }
 
   // Set tempo, where 0.5 = half speed, 1.0 = normal, 2.0 = double speed
   void set_tempo(double);
+  double tempo() const { return tempo_; }
 
   // Set voice muting bitmask
   void mute_voices(int);
+  int muted_voices() const { return mute_mask_; }
+
+  // Play current track msec milliseconds longer before fading it out. If it
+  // is fading out already, it fades back in first.
+  void extend(long msec);
 
 private:
-  Music_Emu *emu_;
+  // Current renderer and the one prepared for the next track. Once
+  // next_ready_ is set, only the producer thread touches the next one.
+  Renderer renderers_[2];
+  std::atomic<int> current_;
+  std::atomic<bool> next_ready_;
+  std::atomic<bool> track_changed_;
+  std::thread loader_;
+  std::atomic<bool> loading_;
+  long crossfade_;
   long sample_rate;
+  long emu_rate_;
   bool paused;
-  gme_info_t *track_info_;
-  std::string filename_;
+
+  Seek_Index index_;
+  bool index_stale_; // snapshots were taken with other settings
+  double seek_latency_;
+  std::atomic<long> position_;
+
+  // Settings last requested, applied as they are to new renderers
+  std::atomic<double> stereo_depth_;
+  std::atomic<bool> accuracy_;
+  std::atomic<double> tempo_;
+  std::atomic<int> mute_mask_;
+
+  // Settings changed by the UI thread since the producer last looked, and
+  // time the current track was extended by meanwhile. Repeated changes
+  // coalesce, so the UI never waits and nothing is lost.
+  enum {
+    change_stereo_depth = 1,
+    change_accuracy = 2,
+    change_tempo = 4,
+    change_mute = 8
+  };
+  std::atomic<unsigned> changed_;
+  std::atomic<long> extend_msec_;
+
+  // Settings of the playing renderers, owned by the producer thread. Tempo
+  // moves towards tempo_target_ a step per block; a new mask waits until
+  // mute_level_ has faded the output down to 0, then it fades back up.
+  double live_depth_;
+  bool live_accuracy_;
+  double live_tempo_;
+  double tempo_target_;
+  double tempo_step_;
+  int live_mute_;
+  int mute_target_;
+  int mute_level_;
+  int mute_ramp_;
+
+  // Whether the prepared next renderer has the live settings yet. Set by
+  // the loader before next_ready_, then only touched by the producer.
+  bool next_live_;
+
+  // Samples rendered ahead by the producer thread, played by the audio
+  // callback
+  Ring_Buffer<float> ring_;
+  std::atomic<size_t> ahead_;
+
+  // Converts rendered blocks from emu_rate_ to the device rate. Each block
+  // grows to at most out_block_ samples.
+  Resampler resampler_;
+  std::vector<float> resampled_;
+  int out_block_;
+  Dsp_Chain dsp_;
+  std::thread producer_;
+  std::atomic<bool> producing_;
+  std::atomic<bool> render_ended_;
+  std::atomic<bool> end_signaled_;
+  std::atomic<long> underruns_;
+  int idle_msec_;
+
+  // Adaptive ahead depth, between min_ahead_ and max_ahead_ samples. The
+  // callback records the lowest ring level it saw, the producer adjusts.
+  bool adaptive_;
+  size_t min_ahead_;
+  size_t max_ahead_;
+  std::atomic<size_t> low_water_;
+  long adapt_underruns_;
+  long long adapt_time_;
+  long long calm_since_;
+
+  // Self-pipe written from the producer and audio threads
+  int event_pipe_[2];
+
+  // Real-time mode. The audio thread sets itself up on its first callback.
+  // Memory allocated after init() is locked by lock_new_memory(), which
+  // keeps its last error in lock_error_. Threads keep theirs in the others.
+  Realtime_Report realtime_;
+  std::atomic<gme_err_t> lock_error_;
+  std::atomic<gme_err_t> priority_error_;
+  std::atomic<gme_err_t> render_cpu_error_;
+  std::atomic<gme_err_t> audio_cpu_error_;
+  int render_cpu_;
+  int audio_cpu_;
+  bool audio_setup_;
+
+  Audio_Stats stats_;
+  long buffer_ns_;
+  int buf_size_;
+  long long last_callback_;
 
   void suspend();
   void resume();
-  static void fill_buffer(void *, sample_t *, int);
+  void wait_loader();
+  void signal_event();
+  void start_producer();
+  void stop_producer();
+  void fill_ring();
+  void setup_thread(int priority, int cpu,
+                    std::atomic<gme_err_t> &cpu_error);
+  void lock_new_memory();
+  void produce();
+  void adapt();
+  void render_block(float *out, int count);
+  void apply_settings(Renderer &);
+  void apply_live(Renderer &);
+  void post_change(unsigned change);
+  int live_emus(Music_Emu *out[2]);
+  void run_changes();
+  void extend_live(long msec);
+  void settle();
+  int ramp_settings(int count);
+  void fade_mute(float *out, int count);
+  void build_index();
+  Renderer &cur() { return renderers_[current_]; }
+  Renderer &next() { return renderers_[1 - current_]; }
+  static void fill_buffer(void *, float *, int);
+  static void record_callback(void *, long long ns);
 };
 
 #endif // __PLAYER_H__
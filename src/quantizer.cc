@@ -0,0 +1,180 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "quantizer.h"
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+void samples_to_float(const sample_t *in, float *out, int count) {
+  int i = 0;
+#ifdef __SSE2__
+  const __m128 scale = _mm_set1_ps(1.0f / 32768);
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+  }
+#endif
+  for (; i < count; i++)
+    out[i] = in[i] * (1.0f / 32768);
+}
+
+Quantizer::Quantizer() {
+  dither_ = dither_none;
+  // Any nonzero seeds will do for xorshift
+  seed_[0] = 0x9e3779b9;
+  seed_[1] = 0x7f4a7c15;
+  seed_[2] = 0x85ebca6b;
+  seed_[3] = 0xc2b2ae35;
+  reset();
+}
+
+void Quantizer::set_dither(int mode) {
+  dither_ = mode;
+  reset();
+}
+
+void Quantizer::reset() { memset(error_, 0, sizeof(error_)); }
+
+// Next xorshift32 value of seed
+static inline uint32_t next_random(uint32_t &seed) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+// Uniform noise in [-0.5, 0.5) LSB from random bits
+static inline float uniform(uint32_t bits) {
+  return (int32_t)bits * (1.0f / 4294967296.0f);
+}
+
+#ifdef __SSE2__
+// Four lanes of xorshift32
+static inline __m128i next_random(__m128i &seed) {
+  seed = _mm_xor_si128(seed, _mm_slli_epi32(seed, 13));
+  seed = _mm_xor_si128(seed, _mm_srli_epi32(seed, 17));
+  seed = _mm_xor_si128(seed, _mm_slli_epi32(seed, 5));
+  return seed;
+}
+
+// Two uniform values per lane add up to triangular noise of 1 LSB peak
+static inline __m128 tpdf_noise(__m128i &seed) {
+  __m128 a = _mm_cvtepi32_ps(next_random(seed));
+  __m128 b = _mm_cvtepi32_ps(next_random(seed));
+  return _mm_mul_ps(_mm_add_ps(a, b), _mm_set1_ps(1.0f / 4294967296.0f));
+}
+#endif
+
+static inline sample_t saturate(long s) {
+  return s < -32768 ? -32768 : s > 32767 ? 32767 : s;
+}
+
+void Quantizer::to_s16(const float *in, sample_t *out, int count) {
+  if (dither_ == dither_shaped) {
+    shaped_to_s16(in, out, count);
+    return;
+  }
+
+  bool tpdf = dither_ == dither_tpdf;
+  int i = 0;
+#ifdef __SSE2__
+  const __m128 scale = _mm_set1_ps(32768.0f);
+  const __m128 max = _mm_set1_ps(32767.0f), min = _mm_set1_ps(-32768.0f);
+  __m128i seed = _mm_loadu_si128((const __m128i *)seed_);
+  for (; i + 8 <= count; i += 8) {
+    __m128 lo = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+    __m128 hi = _mm_mul_ps(_mm_loadu_ps(in + i + 4), scale);
+    if (tpdf) {
+      lo = _mm_add_ps(lo, tpdf_noise(seed));
+      hi = _mm_add_ps(hi, tpdf_noise(seed));
+    }
+    // Clamp first: out of range floats would convert to INT32_MIN
+    lo = _mm_max_ps(_mm_min_ps(lo, max), min);
+    hi = _mm_max_ps(_mm_min_ps(hi, max), min);
+    _mm_storeu_si128((__m128i *)(out + i),
+                     _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+  }
+  _mm_storeu_si128((__m128i *)seed_, seed);
+#endif
+  for (; i < count; i++) {
+    float s = in[i] * 32768.0f;
+    if (tpdf)
+      s += uniform(next_random(seed_[0])) + uniform(next_random(seed_[0]));
+    out[i] = saturate(lrintf(fmaxf(fminf(s, 32767.0f), -32768.0f)));
+  }
+}
+
+// Error feedback through 2 z^-1 - z^-2 gives the noise a (1 - z^-1)^2
+// spectrum: 12 dB more at Nyquist, much less at low frequencies.
+// Recursive, so one frame at a time.
+void Quantizer::shaped_to_s16(const float *in, sample_t *out, int count) {
+  for (int i = 0; i + 1 < count; i += 2) {
+    for (int c = 0; c < 2; c++) {
+      float *e = error_[c];
+      float wanted = in[i + c] * 32768.0f - (2 * e[0] - e[1]);
+      float dithered = wanted + uniform(next_random(seed_[c])) +
+                       uniform(next_random(seed_[c]));
+      long q = lrintf(fmaxf(fminf(dithered, 32767.0f), -32768.0f));
+      out[i + c] = saturate(q);
+
+      // Clipping would feed back huge errors, so keep them within the
+      // dither range
+      float err = q - wanted;
+      e[1] = e[0];
+      e[0] = fmaxf(fminf(err, 1.5f), -1.5f);
+    }
+  }
+}
+
+void Quantizer::to_s32(const float *in, int32_t *out, int count) {
+  int i = 0;
+#ifdef __SSE2__
+  // 2^31 isn't representable as int32, so stop just below it
+  const __m128 scale = _mm_set1_ps(2147483648.0f);
+  const __m128 max = _mm_set1_ps(2147483520.0f), min = _mm_set1_ps(-1.0f);
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(in + i), _mm_set1_ps(1.0f)),
+                          min);
+    x = _mm_min_ps(_mm_mul_ps(x, scale), max);
+    _mm_storeu_si128((__m128i *)(out + i), _mm_cvtps_epi32(x));
+  }
+#endif
+  for (; i < count; i++) {
+    float x = fmaxf(fminf(in[i], 1.0f), -1.0f) * 2147483648.0f;
+    out[i] = x >= 2147483520.0f ? 2147483520 : (int32_t)lrintf(x);
+  }
+}
+
+void Quantizer::to_f32(const float *in, float *out, int count) {
+  int i = 0;
+#ifdef __SSE2__
+  const __m128 max = _mm_set1_ps(1.0f), min = _mm_set1_ps(-1.0f);
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_ps(out + i,
+                  _mm_max_ps(_mm_min_ps(_mm_loadu_ps(in + i), max), min));
+#endif
+  for (; i < count; i++)
+    out[i] = fmaxf(fminf(in[i], 1.0f), -1.0f);
+}
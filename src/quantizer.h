@@ -0,0 +1,61 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __QUANTIZER_H__
+#define __QUANTIZER_H__
+
+#include "common.h"
+#include <cstdint>
+
+// Scale 16-bit samples to float, where full scale is [-1, 1)
+void samples_to_float(const sample_t *in, float *out, int count);
+
+// Final conversion of float stereo samples to what the output takes,
+// saturating anything past full scale. 16-bit output can be dithered with
+// TPDF noise of 1 LSB peak, or with TPDF noise shaped by second order error
+// feedback, which moves it up to where the ear is least sensitive. Plain and
+// TPDF conversion run on SSE2 when available. Never allocates.
+class Quantizer {
+public:
+  enum { dither_none, dither_tpdf, dither_shaped };
+
+  Quantizer();
+
+  void set_dither(int mode);
+  int dither() const { return dither_; }
+
+  // Forget error feedback state, e.g. after seeking
+  void reset();
+
+  // Convert count samples (count / 2 stereo frames)
+  void to_s16(const float *in, sample_t *out, int count);
+
+  // 32-bit output is never dithered: float has less precision than that
+  void to_s32(const float *in, int32_t *out, int count);
+
+  // Float output is only clipped to full scale, so gain can't push it past
+  // what the device takes. in and out may be the same.
+  void to_f32(const float *in, float *out, int count);
+
+private:
+  int dither_;
+  uint32_t seed_[4];
+  float error_[2][2]; // last two errors of each channel, newest first
+
+  void shaped_to_s16(const float *in, sample_t *out, int count);
+};
+
+#endif // __QUANTIZER_H__
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "realtime.h"
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+gme_err_t set_realtime_priority(int priority) {
+#ifdef __linux__
+  sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = priority;
+  int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (err == EPERM)
+    return "Not permitted (needs CAP_SYS_NICE or an rtprio limit)";
+  if (err)
+    return "Couldn't set real-time priority";
+  return 0;
+#else
+  (void)priority;
+  return "Not supported on this system";
+#endif
+}
+
+gme_err_t pin_thread(int cpu) {
+#ifdef __linux__
+  if (cpu < 0 || cpu >= CPU_SETSIZE)
+    return "No such CPU";
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+    return "No such CPU, or not allowed to use it";
+  return 0;
+#else
+  (void)cpu;
+  return "Not supported on this system";
+#endif
+}
+
+gme_err_t lock_memory(bool &future) {
+  future = false;
+#ifdef __linux__
+  // Locking future pages under a finite limit would make allocations fail
+  // once it is reached, so then only what is mapped now gets locked. Root
+  // is not bound by the limit.
+  rlimit limit;
+  bool unlimited = geteuid() == 0 || (!getrlimit(RLIMIT_MEMLOCK, &limit) &&
+                                      limit.rlim_cur == RLIM_INFINITY);
+  if (unlimited && !mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    future = true;
+    return 0;
+  }
+#endif
+  return lock_current_memory();
+}
+
+gme_err_t lock_current_memory() {
+#ifdef __linux__
+  if (!mlockall(MCL_CURRENT))
+    return 0;
+  if (errno == EPERM || errno == ENOMEM)
+    return "Not permitted (needs CAP_IPC_LOCK or a higher memlock limit)";
+  return "Couldn't lock memory";
+#else
+  return "Not supported on this system";
+#endif
+}
+
+gme_err_t prefault_stack(size_t bytes) {
+  // Volatile so the writes aren't optimized away
+  volatile char *stack = (volatile char *)__builtin_alloca(bytes);
+  for (size_t i = 0; i < bytes; i += 4096)
+    stack[i] = 0;
+#ifdef __linux__
+  if (mlock((const void *)stack, bytes))
+    return "Couldn't lock stack";
+  return 0;
+#else
+  return "Not supported on this system";
+#endif
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __REALTIME_H__
+#define __REALTIME_H__
+
+#include "common.h"
+#include <cstddef>
+
+// Real-time scheduling, CPU pinning and memory locking, for the threads that
+// must never miss a deadline. Everything is best effort: each function says
+// why it failed, and playback goes on without that guarantee. Only
+// supported on Linux; elsewhere every function fails.
+
+// Run calling thread with SCHED_FIFO at priority, from 1 to 99
+gme_err_t set_realtime_priority(int priority);
+
+// Run calling thread only on cpu
+gme_err_t pin_thread(int cpu);
+
+// Lock every current page of the process in memory and, if the memory lock
+// limit allows, every page mapped from now on. future is set to whether
+// later allocations are locked too.
+gme_err_t lock_memory(bool &future);
+
+// Lock every page mapped now, including those mapped since lock_memory
+gme_err_t lock_current_memory();
+
+// Touch and lock the next bytes of the calling thread's stack, so the first
+// deep call doesn't page fault
+gme_err_t prefault_stack(size_t bytes = 64 * 1024);
+
+#endif // __REALTIME_H__
@@ -0,0 +1,330 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "renderer.h"
+#include "dsp_chain.h"
+#include "loudness_analyzer.h"
+#include "quantizer.h"
+#include "rom_image.h"
+#include "track_cache.h"
+#include "wave_writer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Number of samples generated on each call to gme_play when rendering
+const int render_block = 16384;
+
+// Number of samples converted to float at a time
+const int convert_block = 4096;
+
+const Track_Cache *Renderer::length_cache_ = nullptr;
+int Renderer::loop_count_ = 2;
+const Track_Cache *Renderer::loudness_cache_ = nullptr;
+double Renderer::loudness_target_ = -18;
+long Renderer::fade_out_msec_ = 8000;
+long Renderer::fade_in_msec_ = 50;
+int Renderer::fade_curve_ = Renderer::curve_log;
+
+void Renderer::set_length_cache(const Track_Cache *cache) {
+  length_cache_ = cache;
+}
+
+void Renderer::set_loop_count(int count) { loop_count_ = count; }
+
+void Renderer::set_loudness_cache(const Track_Cache *cache, double target) {
+  loudness_cache_ = cache;
+  loudness_target_ = target;
+}
+
+double Renderer::gain() const { return 20 * log10(gain_); }
+
+void Renderer::set_fade(long out_msec, long in_msec, int curve) {
+  fade_out_msec_ = out_msec;
+  fade_in_msec_ = in_msec;
+  fade_curve_ = curve;
+}
+
+// Gain along a fade curve, from 0 at x = 0 up to 1 at x = 1
+static float curve_gain(int curve, double x) {
+  switch (curve) {
+  case Renderer::curve_linear:
+    return x;
+  case Renderer::curve_cosine:
+    return 0.5 - 0.5 * cos(M_PI * x);
+  default:
+    // Linear in decibels over 60 dB, and 0 at the very start
+    return (pow(1000, x) - 1) / 999;
+  }
+}
+
+Renderer::Renderer() {
+  emu_ = nullptr;
+  sample_rate_ = 0;
+  track_ = -1;
+  position_ = 0;
+  fade_ = true;
+  track_info_ = nullptr;
+  gain_ = 1;
+  fade_start_ = 0;
+  fade_in_end_ = 0;
+  fade_in_samples_ = 0;
+}
+
+Renderer::~Renderer() {
+  unload();
+}
+
+void Renderer::unload() {
+  gme_delete(emu_);
+  emu_ = nullptr;
+  gme_free_info(track_info_);
+  track_info_ = nullptr;
+  track_ = -1;
+  image_.reset();
+}
+
+gme_err_t Renderer::load_file(const string &path, long sample_rate) {
+  unload();
+
+  filename_ = path;
+  sample_rate_ = sample_rate;
+
+  // Same as gme_open_file, but from the shared image: identify by header,
+  // then by extension
+  RETURN_ERR(Rom_Image::open(path, image_));
+  gme_type_t type = 0;
+  if (image_->size() >= 4)
+    type = gme_identify_extension(gme_identify_header(image_->data()));
+  if (!type)
+    type = gme_identify_extension(path.c_str());
+  if (!type)
+    return gme_wrong_file_type;
+  emu_ = gme_new_emu(type, sample_rate);
+  if (!emu_)
+    return "Out of memory";
+#if defined(GME_VERSION) && GME_VERSION >= 0x000603
+  // Fades are ours, don't let the emulator stop at the track length
+  gme_set_autoload_playback_limit(emu_, false);
+#endif
+  if (gme_err_t err = gme_load_data(emu_, image_->data(), image_->size())) {
+    unload();
+    return err;
+  }
+
+  if (gme_load_m3u(emu_, m3u_path(path).c_str())) {
+  } // ignore error
+
+  return 0;
+}
+
+string Renderer::m3u_path(const string &path) {
+  size_t dot = path.rfind('.');
+  return path.substr(0, dot) + ".m3u";
+}
+
+int Renderer::track_count() const {
+  return emu_ ? gme_track_count(emu_) : false;
+}
+
+// Fill in length of track if unknown. Returns false if the track is known to
+// end by itself, and so it shouldn't fade out.
+bool Renderer::set_length(gme_info_t *info, int track) const {
+  vector<double> cached;
+  if (info->length <= 0 && length_cache_ &&
+      length_cache_->get(filename_, track, cached)) {
+    if (cached.size() >= 2 && cached[0] > 0) {
+      info->length = cached[0];
+      return !cached[1];
+    }
+    if (cached.size() >= 4 && cached[3] > 0 && info->loop_length <= 0) {
+      info->intro_length = cached[2];
+      info->loop_length = cached[3];
+    }
+  }
+
+  if (info->length <= 0 && info->loop_length > 0)
+    info->length =
+        max(info->intro_length, 0) + info->loop_length * loop_count_;
+
+  if (info->length <= 0)
+    info->length = (long)(2.5 * 60 * 1000);
+  return true;
+}
+
+long Renderer::track_length(int track) const {
+  gme_info_t *info;
+  if (!emu_ || gme_track_info(emu_, &info, track))
+    return 0;
+  set_length(info, track);
+  long length = info->length;
+  gme_free_info(info);
+  return length;
+}
+
+gme_err_t Renderer::start_track(int track, bool fade) {
+  if (emu_) {
+    gme_free_info(track_info_);
+    track_info_ = nullptr;
+    RETURN_ERR(gme_track_info(emu_, &track_info_, track));
+
+    RETURN_ERR(gme_start_track(emu_, track));
+    track_ = track;
+    position_ = 0;
+
+    // Calculate track length
+    fade_ = set_length(track_info_, track) && fade;
+    fade_start_ = track_info_->length * sample_rate_ / 1000 * 2;
+    fade_in_end_ = 0;
+    fade_in_samples_ = 0;
+
+    vector<double> cached;
+    gain_ = 1;
+    if (loudness_cache_ && loudness_cache_->get(filename_, track, cached) &&
+        cached.size() >= 2)
+      gain_ = pow(10, Loudness_Analyzer::gain_for(cached[0], cached[1],
+                                                  loudness_target_) / 20);
+  }
+  return 0;
+}
+
+gme_err_t Renderer::play(int count, sample_t *out) {
+  if (!emu_) {
+    memset(out, 0, count * sizeof(sample_t));
+    return 0;
+  }
+  position_ += count;
+  return gme_play(emu_, count, out);
+}
+
+gme_err_t Renderer::play(int count, float *out) {
+  // The only conversion from the emulator's 16-bit samples: gain and fades
+  // are applied in float, and nothing is rounded again before output
+  long pos = position_;
+  sample_t buf[convert_block];
+  for (int start = 0; start < count; start += convert_block) {
+    int n = min(count - start, convert_block);
+    RETURN_ERR(play(n, buf));
+    samples_to_float(buf, out + start, n);
+  }
+
+  // Outside fades the gain is constant, and usually 1
+  if (pos >= fade_in_end_ && (!fade_ || pos + count <= fade_start_)) {
+    if (gain_ != 1) {
+      for (int i = 0; i < count; i++)
+        out[i] *= gain_;
+    }
+    return 0;
+  }
+
+  for (int i = 0; i < count; i += 2) {
+    float g = gain_ * fade_gain(pos + i);
+    out[i] *= g;
+    out[i + 1] *= g;
+  }
+  return 0;
+}
+
+long Renderer::fade_samples() const {
+  return fade_out_msec_ * sample_rate_ / 1000 * 2;
+}
+
+float Renderer::fade_gain(long pos) const {
+  float g = 1;
+  if (pos < fade_in_end_)
+    g = curve_gain(fade_curve_,
+                   1 - (double)(fade_in_end_ - pos) / fade_in_samples_);
+  if (fade_ && pos >= fade_start_) {
+    long length = fade_samples();
+    long done = pos - fade_start_;
+    g *= done >= length
+             ? 0
+             : curve_gain(fade_curve_, 1 - (double)done / length);
+  }
+  return g;
+}
+
+void Renderer::set_fade_start(long pos) {
+  if (!fade_ || pos == fade_start_)
+    return;
+
+  // Fade back in from the gain reached so far
+  long length = fade_samples();
+  long done = position_ - fade_start_;
+  if (done > 0 && done < length && pos > position_) {
+    fade_in_samples_ = length;
+    fade_in_end_ = position_ + done;
+  }
+  fade_start_ = pos;
+}
+
+gme_err_t Renderer::seek(long msec) {
+  if (!emu_)
+    return "No file loaded";
+  RETURN_ERR(gme_seek(emu_, msec));
+  position_ = msec * sample_rate_ / 1000 * 2;
+  fade_in_samples_ = fade_in_msec_ * sample_rate_ / 1000 * 2;
+  fade_in_end_ = position_ + fade_in_samples_;
+  return 0;
+}
+
+void Renderer::swap(Renderer &other) {
+  std::swap(emu_, other.emu_);
+  std::swap(sample_rate_, other.sample_rate_);
+  std::swap(track_, other.track_);
+  std::swap(position_, other.position_);
+  std::swap(fade_, other.fade_);
+  std::swap(track_info_, other.track_info_);
+  std::swap(gain_, other.gain_);
+  std::swap(fade_start_, other.fade_start_);
+  std::swap(fade_in_end_, other.fade_in_end_);
+  std::swap(fade_in_samples_, other.fade_in_samples_);
+  filename_.swap(other.filename_);
+  image_.swap(other.image_);
+}
+
+long Renderer::track_samples() const {
+  if (!track_info_)
+    return 0;
+  return fade_start_ + (fade_ ? fade_samples() : 0);
+}
+
+gme_err_t Renderer::render(Wave_Writer &out, Dsp_Chain *dsp) {
+  if (!emu_)
+    return "No file loaded";
+
+  float buf[render_block];
+  while (!track_ended() && tell() < track_samples()) {
+    long count = min(track_samples() - tell(), (long)render_block);
+    RETURN_ERR(play(count, buf));
+    if (dsp)
+      dsp->process(buf, count);
+    RETURN_ERR(out.write(buf, count));
+  }
+  return 0;
+}
+
+bool Renderer::track_ended() const {
+  if (!emu_)
+    return false;
+  return gme_track_ended(emu_) ||
+         (fade_ && position_ >= fade_start_ + fade_samples());
+}
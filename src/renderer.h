@@ -0,0 +1,172 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
+#include "common.h"
+#include <memory>
+#include <string>
+
+class Dsp_Chain;
+class Rom_Image;
+class Track_Cache;
+class Wave_Writer;
+
+// Emulator wrapper without any audio output. It knows how long each track
+// should play, and can be pulled from as fast as the emulator runs.
+class Renderer {
+public:
+  Renderer();
+  ~Renderer();
+
+  // Load game music file. The file is mapped once and shared with every
+  // other renderer that loads it. NULL on success, otherwise error string.
+  gme_err_t load_file(const std::string &path, long sample_rate = 44100);
+
+  // Unload current file
+  void unload();
+
+  // Playlist loaded along with music file path, if it exists
+  static std::string m3u_path(const std::string &path);
+
+  // (Re)start track and, unless fade is false, set up its fade out. Tracks
+  // are numbered from 0 to track_count() - 1. Fades are applied to the
+  // output, not by the emulator, so they can change while the track plays.
+  gme_err_t start_track(int track, bool fade = true);
+
+  // Generate count samples (count / 2 stereo frames) into out, with
+  // loudness gain and fades applied. Full scale is [-1, 1), but gain can
+  // push samples past it: they are clipped only when quantized for output.
+  gme_err_t play(int count, float *out);
+
+  // Generate count samples of raw emulator output, without gain or fades
+  gme_err_t play(int count, sample_t *out);
+
+  // Seek to msec milliseconds into current track and fade in from there.
+  // Seeking backwards restarts the track, so it is as slow as playing up to
+  // that point.
+  gme_err_t seek(long msec);
+
+  // Exchange emulator and track state with another renderer
+  void swap(Renderer &);
+
+  // Play current track until it ends, writing all samples to out, through
+  // dsp if given
+  gme_err_t render(Wave_Writer &out, Dsp_Chain *dsp = nullptr);
+
+  //
+  // Optional functions
+  //
+
+  // Return currently loaded filename
+  const std::string &filename() const { return filename_; }
+
+  // Sample rate of loaded file
+  long sample_rate() const { return sample_rate_; }
+
+  // Number of tracks in current file, or 0 if no file loaded.
+  int track_count() const;
+
+  // Playing time of a track in milliseconds before it fades out, guessed
+  // when the file has no timing information.
+  long track_length(int track) const;
+
+  // Current track, or -1 if no track started
+  int current_track() const { return track_; }
+
+  // Info for current track
+  gme_info_t const &track_info() const { return *track_info_; }
+
+  // Number of samples played since the track started
+  long tell() const { return position_; }
+
+  // Number of samples in current track, including its fade out
+  long track_samples() const;
+
+  // True if current track fades out at the end, false if it is known to end
+  // by itself
+  bool fades() const { return fade_; }
+
+  // True if track ended, or faded out completely
+  bool track_ended() const;
+
+  // Sample position where the fade out starts
+  long fade_start() const { return fade_start_; }
+
+  // Move the fade out to start at sample position pos. If the track is
+  // already fading out and pos is later, it fades back in along the same
+  // curve. Does nothing for tracks that don't fade.
+  void set_fade_start(long pos);
+
+  // Pointer to emulator, or NULL if no file loaded.
+  Music_Emu *emu() const { return emu_; }
+
+  // Fade curves
+  enum { curve_linear, curve_log, curve_cosine };
+
+  // Fade out tracks for out_msec milliseconds (8000 by default), fade in for
+  // in_msec milliseconds after seeking (50 by default), both along curve
+  // (curve_log by default, which is linear in decibels)
+  static void set_fade(long out_msec, long in_msec, int curve);
+
+  // Duration of the fade out at the end of each track, in milliseconds
+  static long fade_length() { return fade_out_msec_; }
+
+  // Use track lengths measured by Length_Analyzer for tracks without timing
+  // information. Values are length in msec, whether the track ends by
+  // itself, and intro and loop length in msec.
+  static void set_length_cache(const Track_Cache *cache);
+
+  // Number of loops played before fading out tracks with known intro and
+  // loop length but no explicit length (2 by default)
+  static void set_loop_count(int count);
+
+  // Normalize tracks measured by Loudness_Analyzer to target loudness in
+  // LUFS. Values are integrated loudness in LUFS and true peak in dBTP.
+  static void set_loudness_cache(const Track_Cache *cache, double target);
+
+  // Gain applied to current track by loudness normalization, in dB
+  double gain() const;
+
+private:
+  Music_Emu *emu_;
+  long sample_rate_;
+  int track_;
+  long position_;
+  bool fade_;
+  gme_info_t *track_info_;
+  float gain_;
+  long fade_start_;
+  long fade_in_end_;
+  long fade_in_samples_;
+  std::string filename_;
+  std::shared_ptr<const Rom_Image> image_;
+
+  static const Track_Cache *length_cache_;
+  static int loop_count_;
+  static const Track_Cache *loudness_cache_;
+  static double loudness_target_;
+  static long fade_out_msec_;
+  static long fade_in_msec_;
+  static int fade_curve_;
+
+  bool set_length(gme_info_t *info, int track) const;
+  long fade_samples() const;
+  float fade_gain(long pos) const;
+};
+
+#endif // __RENDERER_H__
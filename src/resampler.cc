@@ -0,0 +1,233 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "resampler.h"
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLER_X86
+#endif
+
+using namespace std;
+
+// Filter length, Kaiser window beta and cutoff (relative to the lower
+// Nyquist frequency) of each quality level
+static const struct {
+  int taps;
+  double beta;
+  double cutoff;
+} qualities[Resampler::quality_count] = {
+    {8, 5.0, 0.85},
+    {16, 7.0, 0.90},
+    {32, 9.0, 0.94},
+};
+
+// Rates that don't reduce to a ratio with at most this many phases are
+// approximated, off by less than 0.01%
+const int max_phases = 4096;
+
+typedef float (*dot_t)(const float *a, const float *b, int n);
+
+static float dot_scalar(const float *a, const float *b, int n) {
+  float sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+#ifdef RESAMPLER_X86
+__attribute__((target("sse2"))) static float dot_sse2(const float *a,
+                                                      const float *b, int n) {
+  __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+  for (int i = 0; i < n; i += 8) {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i),
+                                       _mm_loadu_ps(b + i)));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                       _mm_loadu_ps(b + i + 4)));
+  }
+  float v[4];
+  _mm_storeu_ps(v, _mm_add_ps(sum0, sum1));
+  return (v[0] + v[1]) + (v[2] + v[3]);
+}
+
+__attribute__((target("avx2,fma"))) static float dot_avx2(const float *a,
+                                                          const float *b,
+                                                          int n) {
+  __m256 sum = _mm256_setzero_ps();
+  for (int i = 0; i < n; i += 8)
+    sum = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum);
+  __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum),
+                           _mm256_extractf128_ps(sum, 1));
+  float v[4];
+  _mm_storeu_ps(v, half);
+  return (v[0] + v[1]) + (v[2] + v[3]);
+}
+#endif
+
+// Best inner product for this CPU, chosen once
+static dot_t select_dot(const char **name) {
+#ifdef RESAMPLER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    *name = "avx2";
+    return dot_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    *name = "sse2";
+    return dot_sse2;
+  }
+#endif
+  *name = "scalar";
+  return dot_scalar;
+}
+
+static const char *dot_name;
+static const dot_t dot = select_dot(&dot_name);
+
+const char *Resampler::simd_name() { return dot_name; }
+
+// Zeroth order modified Bessel function of the first kind
+static double bessel_i0(double x) {
+  double sum = 1, term = 1;
+  for (int k = 1; k < 50 && term > sum * 1e-12; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+static long gcd(long a, long b) {
+  while (b) {
+    long t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+Resampler::Resampler() {
+  in_rate_ = out_rate_ = 0;
+  taps_ = 8;
+  phases_ = step_ = 1;
+  phase_ = 0;
+  max_frames_ = 0;
+  pos_ = len_ = 0;
+}
+
+gme_err_t Resampler::init(long in_rate, long out_rate, int quality,
+                          int max_count) {
+  if (in_rate <= 0 || out_rate <= 0)
+    return "Invalid sample rate";
+  if (quality < 0 || quality >= quality_count)
+    return "Invalid resampler quality";
+
+  in_rate_ = in_rate;
+  out_rate_ = out_rate;
+  taps_ = qualities[quality].taps;
+  max_frames_ = max_count / 2;
+
+  long g = gcd(in_rate, out_rate);
+  phases_ = out_rate / g;
+  step_ = in_rate / g;
+  if (phases_ > max_phases) {
+    step_ = (int)((double)in_rate * max_phases / out_rate + 0.5);
+    phases_ = max_phases;
+  }
+
+  // Windowed sinc, lowpassed below the lower of both Nyquist frequencies
+  double cutoff = qualities[quality].cutoff *
+                  (out_rate < in_rate ? (double)out_rate / in_rate : 1.0);
+  double beta = qualities[quality].beta;
+  double half = taps_ / 2;
+  coeffs_.assign((size_t)phases_ * taps_, 0.0f);
+  for (int p = 0; p < phases_; p++) {
+    float *h = &coeffs_[(size_t)p * taps_];
+    double sum = 0;
+    for (int k = 0; k < taps_; k++) {
+      double t = k - (half - 1) - (double)p / phases_;
+      double x = t * cutoff * M_PI;
+      double sinc = x == 0 ? 1.0 : sin(x) / x;
+      double w = t / half;
+      double window = fabs(w) >= 1 ? 0.0
+                                   : bessel_i0(beta * sqrt(1 - w * w)) /
+                                         bessel_i0(beta);
+      h[k] = sinc * window;
+      sum += h[k];
+    }
+    // Unity gain at DC for every phase
+    for (int k = 0; k < taps_; k++)
+      h[k] /= sum;
+  }
+
+  clear();
+  return 0;
+}
+
+void Resampler::clear() {
+  // Start with half a filter of silence, so the first output frame is
+  // centered on the first input frame
+  len_ = taps_ / 2 - 1;
+  pos_ = 0;
+  phase_ = 0;
+
+  // Less than a filter is left over between blocks, so this is as much as
+  // a whole block ever needs
+  for (auto &h : hist_)
+    h.assign(2 * taps_ + max_frames_, 0.0f);
+}
+
+int Resampler::max_output(int count) const {
+  return ((long)count / 2 * phases_ / step_ + 2) * 2;
+}
+
+int Resampler::process(const float *in, int count, float *out,
+                       int max_out) {
+  // Buffer input, one array per channel, with room for a whole filter past
+  // the end
+  int frames = count / 2;
+  for (auto &h : hist_)
+    if (h.size() < len_ + frames + taps_)
+      h.resize(len_ + frames + taps_);
+  float *l = hist_[0].data(), *r = hist_[1].data();
+  for (int i = 0; i < frames; i++) {
+    l[len_ + i] = in[i * 2];
+    r[len_ + i] = in[i * 2 + 1];
+  }
+  len_ += frames;
+
+  int n = 0;
+  while (pos_ + taps_ <= len_ && n + 2 <= max_out) {
+    const float *h = &coeffs_[(size_t)phase_ * taps_];
+    out[n++] = dot(l + pos_, h, taps_);
+    out[n++] = dot(r + pos_, h, taps_);
+
+    phase_ += step_;
+    pos_ += phase_ / phases_;
+    phase_ %= phases_;
+  }
+
+  // Drop input no filter will reach again
+  size_t drop = pos_ < len_ ? pos_ : len_;
+  if (drop) {
+    memmove(l, l + drop, (len_ - drop) * sizeof(float));
+    memmove(r, r + drop, (len_ - drop) * sizeof(float));
+    len_ -= drop;
+    pos_ -= drop;
+  }
+  return n;
+}
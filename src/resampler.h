@@ -0,0 +1,72 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RESAMPLER_H__
+#define __RESAMPLER_H__
+
+#include "common.h"
+#include <cstddef>
+#include <vector>
+
+// Polyphase windowed-sinc sample rate converter for stereo samples. Inner
+// products run on AVX2 or SSE2 when the CPU has them.
+class Resampler {
+public:
+  // Quality levels, from cheapest to most accurate
+  enum { quality_low, quality_medium, quality_high, quality_count };
+
+  Resampler();
+
+  // Set up conversion from in_rate to out_rate, for input blocks of up to
+  // max_count samples, which process() then converts without allocating.
+  // NULL on success, otherwise error string.
+  gme_err_t init(long in_rate, long out_rate, int quality = quality_medium,
+                 int max_count = 0);
+
+  // Forget buffered input, e.g. after seeking
+  void clear();
+
+  // Convert count samples (count / 2 stereo frames) from in, writing at most
+  // max_out samples to out. All input is consumed; make max_out at least
+  // max_output(count). Returns number of samples written.
+  int process(const float *in, int count, float *out, int max_out);
+
+  // Most samples process can output for count input samples
+  int max_output(int count) const;
+
+  // True if rates differ, so there is anything to convert
+  bool active() const { return in_rate_ != out_rate_; }
+
+  long in_rate() const { return in_rate_; }
+  long out_rate() const { return out_rate_; }
+
+  // Instruction set used for the inner products: "avx2", "sse2" or "scalar"
+  static const char *simd_name();
+
+private:
+  long in_rate_, out_rate_;
+  int taps_;     // filter length, a multiple of 8
+  int phases_;   // filter phases, output steps per input step * step_
+  int step_;     // phase advance per output frame
+  int phase_;
+  int max_frames_; // input frames per block buffered without allocating
+  size_t pos_;   // first input frame under the filter
+  size_t len_;   // input frames buffered
+  std::vector<float> coeffs_;  // phases_ filters of taps_ coefficients
+  std::vector<float> hist_[2]; // buffered input, one array per channel
+};
+
+#endif // __RESAMPLER_H__
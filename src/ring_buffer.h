@@ -0,0 +1,115 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RING_BUFFER_H__
+#define __RING_BUFFER_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Lock-free ring buffer for exactly one producer thread and one consumer
+// thread. Neither side ever blocks or allocates; reads and writes simply
+// transfer as much as there is data or room for. T must be trivially
+// copyable.
+template <typename T> class Ring_Buffer {
+public:
+  Ring_Buffer() : mask_(0), write_pos_(0), read_pos_(0) {}
+
+  // Set capacity, rounded up to a power of two. Discards contents, so it
+  // must not be called while either side is active.
+  void resize(size_t capacity) {
+    size_t n = 1;
+    while (n < capacity)
+      n *= 2;
+    buf_.assign(n, T());
+    mask_ = n - 1;
+    clear();
+  }
+
+  // Discard contents. Must not be called while either side is active.
+  void clear() {
+    write_pos_.store(0, std::memory_order_relaxed);
+    read_pos_.store(0, std::memory_order_relaxed);
+  }
+
+  // Total number of elements it can hold
+  size_t capacity() const { return buf_.size(); }
+
+  // Number of elements available for reading. Safe from any thread: read
+  // position first, so a stale one can't pass the write position. Still
+  // stale by the time both are loaded, so it's clamped to capacity.
+  size_t size() const {
+    size_t r = read_pos_.load(std::memory_order_acquire);
+    size_t w = write_pos_.load(std::memory_order_acquire);
+    return w - r < capacity() ? w - r : capacity();
+  }
+
+  // Number of elements that can be written
+  size_t free_space() const { return capacity() - size(); }
+
+  // Producer side: copy up to count elements in. Returns number written.
+  size_t write(const T *in, size_t count) {
+    size_t w = write_pos_.load(std::memory_order_relaxed);
+    size_t r = read_pos_.load(std::memory_order_acquire);
+    if (count > capacity() - (w - r))
+      count = capacity() - (w - r);
+    if (count)
+      copy_in(w, in, count);
+    write_pos_.store(w + count, std::memory_order_release);
+    return count;
+  }
+
+  // Consumer side: copy up to count elements out. Returns number read.
+  size_t read(T *out, size_t count) {
+    size_t r = read_pos_.load(std::memory_order_relaxed);
+    size_t w = write_pos_.load(std::memory_order_acquire);
+    if (count > w - r)
+      count = w - r;
+    if (count)
+      copy_out(r, out, count);
+    read_pos_.store(r + count, std::memory_order_release);
+    return count;
+  }
+
+private:
+  std::vector<T> buf_;
+  size_t mask_;
+
+  // Positions only ever grow; keep them on separate cache lines so producer
+  // and consumer don't fight over the same one.
+  std::atomic<size_t> write_pos_;
+  char padding_[64];
+  std::atomic<size_t> read_pos_;
+
+  // Copy to or from the ring starting at pos, wrapping around its end
+  void copy_in(size_t pos, const T *in, size_t count) {
+    size_t start = pos & mask_;
+    size_t first = count < capacity() - start ? count : capacity() - start;
+    memcpy(&buf_[start], in, first * sizeof(T));
+    memcpy(&buf_[0], in + first, (count - first) * sizeof(T));
+  }
+
+  void copy_out(size_t pos, T *out, size_t count) const {
+    size_t start = pos & mask_;
+    size_t first = count < capacity() - start ? count : capacity() - start;
+    memcpy(out, &buf_[start], first * sizeof(T));
+    memcpy(out + first, &buf_[0], (count - first) * sizeof(T));
+  }
+};
+
+#endif // __RING_BUFFER_H__
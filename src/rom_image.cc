@@ -0,0 +1,87 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rom_image.h"
+#include "track_cache.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+mutex Rom_Image::mutex_;
+map<string, weak_ptr<const Rom_Image>> Rom_Image::images_;
+
+Rom_Image::Rom_Image() : data_(nullptr), size_(0), mtime_(0) {}
+
+Rom_Image::~Rom_Image() {
+  if (data_)
+    munmap(data_, size_);
+}
+
+gme_err_t Rom_Image::open(const string &path, shared_ptr<const Rom_Image> &out) {
+  string real_path;
+  long long size, mtime;
+  if (!file_identity(path, real_path, size, mtime))
+    return "Couldn't open file";
+  if (size <= 0)
+    return "Empty file";
+
+  lock_guard<mutex> lock(mutex_);
+
+  // Forget images nobody holds anymore
+  for (auto it = images_.begin(); it != images_.end();) {
+    if (it->second.expired())
+      it = images_.erase(it);
+    else
+      ++it;
+  }
+
+  auto it = images_.find(real_path);
+  if (it != images_.end()) {
+    auto image = it->second.lock();
+    if (image && image->size_ == size && image->mtime_ == mtime) {
+      out = image;
+      return 0;
+    }
+  }
+
+  int fd = ::open(real_path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return "Couldn't open file";
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return "Couldn't map file";
+
+  Rom_Image *image = new Rom_Image;
+  image->data_ = data;
+  image->size_ = size;
+  image->mtime_ = mtime;
+  out.reset(image);
+  images_[real_path] = out;
+  return 0;
+}
+
+uint64_t Rom_Image::hash() const { return hash_bytes(data_, size_); }
+
+uint64_t hash_bytes(const void *data, long size) {
+  const unsigned char *p = (const unsigned char *)data;
+  uint64_t h = 14695981039346656037ULL;
+  for (long i = 0; i < size; i++)
+    h = (h ^ p[i]) * 1099511628211ULL;
+  return h;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ROM_IMAGE_H__
+#define __ROM_IMAGE_H__
+
+#include "common.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Read-only memory map of a music file. Every renderer loading the same file
+// shares one image, which stays mapped while any of them holds it.
+class Rom_Image {
+public:
+  ~Rom_Image();
+
+  // Map file, or reuse the image already mapped for it if the file didn't
+  // change since. NULL on success, otherwise error string.
+  static gme_err_t open(const std::string &path,
+                        std::shared_ptr<const Rom_Image> &out);
+
+  // File contents
+  const void *data() const { return data_; }
+  long size() const { return size_; }
+
+  // 64-bit FNV-1a hash of file contents
+  uint64_t hash() const;
+
+private:
+  Rom_Image();
+
+  void *data_;
+  long size_;
+  long long mtime_;
+
+  static std::mutex mutex_;
+  static std::map<std::string, std::weak_ptr<const Rom_Image>> images_;
+};
+
+// 64-bit FNV-1a hash of size bytes at data
+uint64_t hash_bytes(const void *data, long size);
+
+#endif // __ROM_IMAGE_H__
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "seek_index.h"
+
+using namespace std;
+
+// Emulate in steps of this many milliseconds while building a snapshot, so
+// clear() doesn't have to wait long
+const long build_step = 1000;
+
+Seek_Index::Seek_Index() {
+  sample_rate_ = 0;
+  track_ = -1;
+  interval_ = 10000;
+  max_count_ = 32;
+  running_ = false;
+}
+
+Seek_Index::~Seek_Index() { clear(); }
+
+void Seek_Index::set_interval(long interval_msec, int max_count) {
+  clear();
+  interval_ = interval_msec > 0 ? interval_msec : 1000;
+  max_count_ = max_count;
+}
+
+void Seek_Index::build(const string &path, long sample_rate, int track,
+                       long track_msec, setup_t setup, ready_t ready) {
+  clear();
+
+  path_ = path;
+  sample_rate_ = sample_rate;
+  track_ = track;
+  setup_ = setup;
+  ready_ = ready;
+
+  for (long t = interval_; t < track_msec && (int)slots_.size() < max_count_;
+       t += interval_) {
+    Slot slot;
+    slot.msec = t;
+    slot.ready = false;
+    slot.busy = false;
+    slots_.push_back(move(slot));
+  }
+
+  if (slots_.empty())
+    return;
+
+  running_ = true;
+  builder_ = thread(&Seek_Index::work, this);
+}
+
+void Seek_Index::clear() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    running_ = false;
+  }
+  wake_.notify_all();
+  if (builder_.joinable())
+    builder_.join();
+  slots_.clear();
+}
+
+bool Seek_Index::restore(Renderer &r, long msec) {
+  long current = r.tell() * 1000 / (r.sample_rate() * 2);
+
+  unique_lock<mutex> lock(mutex_);
+  Slot *best = nullptr;
+  for (auto &slot : slots_) {
+    if (slot.msec > msec)
+      break;
+    if (slot.ready)
+      best = &slot;
+  }
+
+  // Playing on from where r already is would be faster
+  if (!best || (current <= msec && current >= best->msec))
+    return false;
+
+  r.swap(*best->renderer);
+  best->ready = false;
+  lock.unlock();
+
+  // Rebuild it from the renderer just swapped out
+  wake_.notify_all();
+  return true;
+}
+
+int Seek_Index::ready_count() const {
+  lock_guard<mutex> lock(mutex_);
+  int n = 0;
+  for (auto &slot : slots_)
+    n += slot.ready;
+  return n;
+}
+
+int Seek_Index::size() const {
+  lock_guard<mutex> lock(mutex_);
+  return slots_.size();
+}
+
+gme_err_t Seek_Index::fill(Renderer &r, long msec) {
+  if (!r.emu() || r.filename() != path_ ||
+      r.sample_rate() != sample_rate_) {
+    RETURN_ERR(r.load_file(path_, sample_rate_));
+    if (setup_)
+      setup_(r);
+  }
+  RETURN_ERR(r.start_track(track_));
+
+  for (long t = 0; t < msec;) {
+    {
+      lock_guard<mutex> lock(mutex_);
+      if (!running_)
+        return "Cancelled";
+    }
+    t = min(t + build_step, msec);
+    RETURN_ERR(r.seek(t));
+  }
+  return 0;
+}
+
+void Seek_Index::work() {
+  unique_lock<mutex> lock(mutex_);
+  while (running_) {
+    // Earliest missing snapshot first
+    Slot *slot = nullptr;
+    for (auto &s : slots_) {
+      if (!s.ready && !s.busy) {
+        slot = &s;
+        break;
+      }
+    }
+    if (!slot) {
+      wake_.wait(lock);
+      continue;
+    }
+
+    slot->busy = true;
+    if (!slot->renderer)
+      slot->renderer.reset(new Renderer);
+    Renderer &r = *slot->renderer;
+    long msec = slot->msec;
+    lock.unlock();
+
+    gme_err_t err = fill(r, msec);
+    if (!err && ready_)
+      ready_();
+
+    lock.lock();
+    slot->busy = false;
+    slot->ready = !err;
+
+    // Don't retry a snapshot that can't be built
+    if (err && running_)
+      slot->busy = true;
+  }
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SEEK_INDEX_H__
+#define __SEEK_INDEX_H__
+
+#include "renderer.h"
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Emulator snapshots of a track taken at regular intervals, so seeking only
+// has to emulate from the nearest snapshot instead of from the start.
+//
+// gme can't save or copy emulator state, so each snapshot is a whole
+// emulator instance parked at its position. Restoring one swaps it in as the
+// live renderer, and the snapshot is rebuilt in the background.
+class Seek_Index {
+public:
+  // Called on each new renderer after loading the file, to apply settings
+  // that change what is emulated (tempo, muting, etc.)
+  typedef std::function<void(Renderer &)> setup_t;
+
+  // Called from the background thread after each snapshot is built
+  typedef std::function<void()> ready_t;
+
+  Seek_Index();
+  ~Seek_Index();
+
+  // Take a snapshot every interval_msec milliseconds, keeping at most
+  // max_count of them
+  void set_interval(long interval_msec, int max_count);
+
+  // Start building snapshots of track in the background, replacing any
+  // previous ones
+  void build(const std::string &path, long sample_rate, int track,
+             long track_msec, setup_t setup = nullptr,
+             ready_t ready = nullptr);
+
+  // Stop background work and drop all snapshots
+  void clear();
+
+  // Swap r with the latest snapshot before msec, if that is closer than r
+  // already is. Returns true if a snapshot was used.
+  bool restore(Renderer &r, long msec);
+
+  // Number of snapshots ready to use
+  int ready_count() const;
+
+  // Number of snapshots the index is building towards
+  int size() const;
+
+  // Milliseconds between snapshots
+  long interval() const { return interval_; }
+
+private:
+  struct Slot {
+    long msec;
+    bool ready;
+    bool busy;
+    std::unique_ptr<Renderer> renderer;
+  };
+
+  std::vector<Slot> slots_;
+  std::string path_;
+  long sample_rate_;
+  int track_;
+  setup_t setup_;
+  ready_t ready_;
+  long interval_;
+  int max_count_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::thread builder_;
+  bool running_;
+
+  void work();
+  gme_err_t fill(Renderer &, long msec);
+};
+
+#endif // __SEEK_INDEX_H__
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "track_cache.h"
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+using namespace std;
+
+string cache_dir() {
+  string dir;
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (xdg && *xdg)
+    dir = xdg;
+  else if (home && *home)
+    dir = string(home) + "/.cache";
+  else
+    dir = "/tmp";
+  mkdir(dir.c_str(), 0755);
+
+  dir += "/nsfp";
+  mkdir(dir.c_str(), 0755);
+  return dir;
+}
+
+bool file_identity(const string &path, string &real_path, long long &size,
+                   long long &mtime) {
+  char buf[PATH_MAX];
+  struct stat st;
+  if (!realpath(path.c_str(), buf) || stat(buf, &st))
+    return false;
+  real_path = buf;
+  size = st.st_size;
+  mtime = st.st_mtime;
+  return true;
+}
+
+Track_Cache::Track_Cache(const string &name) {
+  path_ = cache_dir() + "/" + name;
+  dirty_ = false;
+}
+
+// Each line is: size, mtime, track, values separated by commas, and path,
+// separated by tabs. Paths with tabs or newlines are not cached.
+gme_err_t Track_Cache::load() {
+  lock_guard<mutex> lock(mutex_);
+
+  FILE *f = fopen(path_.c_str(), "r");
+  if (!f)
+    return 0;
+
+  char line[PATH_MAX + 1024];
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\n")] = 0;
+
+    Entry e;
+    int track, n;
+    if (sscanf(line, "%lld\t%lld\t%d\t%n", &e.size, &e.mtime, &track, &n) != 3)
+      continue;
+
+    char *p = line + n;
+    char *tab = strchr(p, '\t');
+    if (!tab)
+      continue;
+    *tab = 0;
+    char *save;
+    for (char *v = strtok_r(p, ",", &save); v; v = strtok_r(nullptr, ",", &save))
+      e.values.push_back(strtod(v, nullptr));
+
+    entries_[make_pair(string(tab + 1), track)] = e;
+  }
+
+  fclose(f);
+  dirty_ = false;
+  return 0;
+}
+
+gme_err_t Track_Cache::save() {
+  lock_guard<mutex> lock(mutex_);
+  if (!dirty_)
+    return 0;
+
+  string tmp = path_ + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "w");
+  if (!f)
+    return "Couldn't write cache file";
+
+  for (auto &it : entries_) {
+    const Entry &e = it.second;
+    fprintf(f, "%lld\t%lld\t%d\t", e.size, e.mtime, it.first.second);
+    for (size_t i = 0; i < e.values.size(); i++)
+      fprintf(f, "%s%.9g", i ? "," : "", e.values[i]);
+    fprintf(f, "\t%s\n", it.first.first.c_str());
+  }
+
+  if (fclose(f) || rename(tmp.c_str(), path_.c_str()))
+    return "Couldn't write cache file";
+
+  dirty_ = false;
+  return 0;
+}
+
+bool Track_Cache::get(const string &path, int track,
+                      vector<double> &values) const {
+  string real_path;
+  long long size, mtime;
+  if (!file_identity(path, real_path, size, mtime))
+    return false;
+
+  lock_guard<mutex> lock(mutex_);
+  auto it = entries_.find(make_pair(real_path, track));
+  if (it == entries_.end() || it->second.size != size ||
+      it->second.mtime != mtime)
+    return false;
+
+  values = it->second.values;
+  return true;
+}
+
+void Track_Cache::put(const string &path, int track,
+                      const vector<double> &values) {
+  string real_path;
+  long long size, mtime;
+  if (!file_identity(path, real_path, size, mtime) ||
+      real_path.find_first_of("\t\n") != string::npos)
+    return;
+
+  lock_guard<mutex> lock(mutex_);
+  Entry &e = entries_[make_pair(real_path, track)];
+  e.size = size;
+  e.mtime = mtime;
+  e.values = values;
+  dirty_ = true;
+}
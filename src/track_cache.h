@@ -0,0 +1,74 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TRACK_CACHE_H__
+#define __TRACK_CACHE_H__
+
+#include "common.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Persistent per-track analysis results (lengths, loudness, ...), stored as
+// a text file in the user cache directory. Entries are keyed by file path
+// and track, and are ignored once the file's size or modification time
+// change. Safe to use from several threads.
+class Track_Cache {
+public:
+  // Use cache file with given name, e.g. "lengths"
+  explicit Track_Cache(const std::string &name);
+
+  // Read cache file. A missing file is not an error.
+  gme_err_t load();
+
+  // Write cache file, replacing it atomically
+  gme_err_t save();
+
+  // Look up values for track of file. True if found and still valid.
+  bool get(const std::string &path, int track,
+           std::vector<double> &values) const;
+
+  // Store values for track of file
+  void put(const std::string &path, int track,
+           const std::vector<double> &values);
+
+  // Full path of the cache file
+  const std::string &path() const { return path_; }
+
+private:
+  struct Entry {
+    long long size;
+    long long mtime;
+    std::vector<double> values;
+  };
+
+  std::string path_;
+  std::map<std::pair<std::string, int>, Entry> entries_;
+  mutable std::mutex mutex_;
+  bool dirty_;
+};
+
+// Identity of a file: canonical path, size and modification time. False if
+// the file can't be read.
+bool file_identity(const std::string &path, std::string &real_path,
+                   long long &size, long long &mtime);
+
+// Directory for nsfp cache files, created if needed
+std::string cache_dir();
+
+#endif // __TRACK_CACHE_H__
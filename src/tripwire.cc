@@ -0,0 +1,174 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef AUDIO_TRIPWIRE
+
+#include "tripwire.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <new>
+#include <pthread.h>
+
+// glibc's own allocator, underneath the malloc defined here
+extern "C" {
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+void *__libc_memalign(size_t, size_t);
+void __libc_free(void *);
+}
+
+// Calls whose backtrace is kept, and frames kept for each
+const int max_traces = 16;
+const int trace_frames = 32;
+
+static struct {
+  const char *what;
+  int frames;
+  void *stack[trace_frames];
+} traces[max_traces];
+
+static std::atomic<long> violations(0);
+
+// Nesting of scopes on this thread, and whether a call is being recorded
+// (backtrace() may allocate the first time)
+static thread_local int scope_depth;
+static thread_local bool recording;
+
+static void trip(const char *what) {
+  if (!scope_depth || recording)
+    return;
+  recording = true;
+  long n = violations++;
+  if (n < max_traces) {
+    traces[n].what = what;
+    traces[n].frames = backtrace(traces[n].stack, trace_frames);
+  }
+  recording = false;
+}
+
+Tripwire_Scope::Tripwire_Scope() { scope_depth++; }
+
+Tripwire_Scope::~Tripwire_Scope() { scope_depth--; }
+
+long tripwire_report() {
+  long n = violations;
+  if (!n)
+    return 0;
+  fprintf(stderr, "Tripwire: %ld allocations or locks on the audio path\n", n);
+  for (long i = 0; i < n && i < max_traces; i++) {
+    fprintf(stderr, "#%ld %s\n", i + 1, traces[i].what);
+    backtrace_symbols_fd(traces[i].stack, traces[i].frames, 2);
+  }
+  return n;
+}
+
+// Load what backtrace() needs before any audio thread runs
+static struct Tripwire_Init {
+  Tripwire_Init() {
+    void *stack[1];
+    backtrace(stack, 1);
+  }
+} tripwire_init;
+
+extern "C" {
+
+void *malloc(size_t size) {
+  trip("malloc");
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  trip("calloc");
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *p, size_t size) {
+  trip("realloc");
+  return __libc_realloc(p, size);
+}
+
+void *memalign(size_t align, size_t size) {
+  trip("memalign");
+  return __libc_memalign(align, size);
+}
+
+void *aligned_alloc(size_t align, size_t size) {
+  trip("aligned_alloc");
+  return __libc_memalign(align, size);
+}
+
+int posix_memalign(void **out, size_t align, size_t size) {
+  trip("posix_memalign");
+  *out = __libc_memalign(align, size);
+  return *out ? 0 : ENOMEM;
+}
+
+void free(void *p) {
+  if (p)
+    trip("free");
+  __libc_free(p);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  typedef int (*lock_t)(pthread_mutex_t *);
+  static lock_t real = (lock_t)dlsym(RTLD_NEXT, "pthread_mutex_lock");
+  trip("pthread_mutex_lock");
+  return real(mutex);
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+  typedef int (*lock_t)(pthread_mutex_t *);
+  static lock_t real = (lock_t)dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+  trip("pthread_mutex_trylock");
+  return real(mutex);
+}
+
+} // extern "C"
+
+void *operator new(size_t size) {
+  trip("operator new");
+  void *p = __libc_malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) {
+  trip("operator new[]");
+  void *p = __libc_malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  if (p)
+    trip("operator delete");
+  __libc_free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  if (p)
+    trip("operator delete[]");
+  __libc_free(p);
+}
+
+#endif // AUDIO_TRIPWIRE
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TRIPWIRE_H__
+#define __TRIPWIRE_H__
+
+// Debug check that the audio path never allocates or takes a lock. In
+// builds with AUDIO_TRIPWIRE defined (cmake -DTRIPWIRE=ON), malloc, free,
+// new, delete and mutex locks are interposed, and every call made by a
+// thread inside a Tripwire_Scope is counted with its backtrace. In other
+// builds all of this compiles to nothing.
+class Tripwire_Scope {
+public:
+#ifdef AUDIO_TRIPWIRE
+  Tripwire_Scope();
+  ~Tripwire_Scope();
+#else
+  Tripwire_Scope() {}
+#endif
+
+  Tripwire_Scope(const Tripwire_Scope &) = delete;
+  Tripwire_Scope &operator=(const Tripwire_Scope &) = delete;
+};
+
+// Print calls caught so far to stderr, with backtraces. Returns how many
+// there were, so a test run can fail on them.
+#ifdef AUDIO_TRIPWIRE
+long tripwire_report();
+#else
+inline long tripwire_report() { return 0; }
+#endif
+
+#endif // __TRIPWIRE_H__
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wave_writer.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+const int header_size = 44;
+const int channel_count = 2;
+
+static void set_le32(unsigned char *p, unsigned long n) {
+  p[0] = n & 0xFF;
+  p[1] = (n >> 8) & 0xFF;
+  p[2] = (n >> 16) & 0xFF;
+  p[3] = (n >> 24) & 0xFF;
+}
+
+static void set_le16(unsigned char *p, unsigned n) {
+  p[0] = n & 0xFF;
+  p[1] = (n >> 8) & 0xFF;
+}
+
+static bool is_little_endian() {
+  const unsigned short n = 1;
+  return *(const unsigned char *)&n == 1;
+}
+
+Wave_Writer::Wave_Writer() {
+  file_ = nullptr;
+  sample_rate_ = 0;
+  sample_count_ = 0;
+  raw_ = false;
+}
+
+Wave_Writer::~Wave_Writer() { close(); }
+
+bool Wave_Writer::is_raw_path(const string &path) {
+  const char *ext = strrchr(path.c_str(), '.');
+  return ext && (!strcmp(ext, ".raw") || !strcmp(ext, ".pcm"));
+}
+
+gme_err_t Wave_Writer::open(const string &path, long sample_rate, bool raw) {
+  RETURN_ERR(close());
+
+  file_ = fopen(path.c_str(), "wb");
+  if (!file_)
+    return "Couldn't open output file";
+
+  sample_rate_ = sample_rate;
+  sample_count_ = 0;
+  raw_ = raw;
+
+  // Leave room for header, written on close
+  if (!raw_) {
+    unsigned char header[header_size] = {0};
+    if (fwrite(header, sizeof(header), 1, file_) != 1)
+      return "Couldn't write output file";
+  }
+
+  return 0;
+}
+
+gme_err_t Wave_Writer::write(const sample_t *in, long count) {
+  if (!file_)
+    return "Output file not open";
+
+  if (is_little_endian()) {
+    if (fwrite(in, sizeof(sample_t), count, file_) != (size_t)count)
+      return "Couldn't write output file";
+  } else {
+    unsigned char buf[1024];
+    for (long i = 0; i < count;) {
+      long n = 0;
+      for (; n < (long)sizeof(buf) && i < count; n += 2)
+        set_le16(buf + n, (unsigned short)in[i++]);
+      if (fwrite(buf, n, 1, file_) != 1)
+        return "Couldn't write output file";
+    }
+  }
+
+  sample_count_ += count;
+  return 0;
+}
+
+gme_err_t Wave_Writer::write(const float *in, long count) {
+  sample_t buf[4096];
+  for (long start = 0; start < count; start += 4096) {
+    int n = min(count - start, 4096L);
+    quantizer_.to_s16(in + start, buf, n);
+    RETURN_ERR(write(buf, n));
+  }
+  return 0;
+}
+
+gme_err_t Wave_Writer::close() {
+  if (!file_)
+    return 0;
+
+  gme_err_t err = 0;
+  if (!raw_) {
+    unsigned long data_size = sample_count_ * sizeof(sample_t);
+    unsigned frame_size = channel_count * sizeof(sample_t);
+    unsigned char h[header_size];
+    memcpy(h, "RIFF", 4);
+    set_le32(h + 4, header_size - 8 + data_size);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    set_le32(h + 16, 16); // fmt chunk size
+    set_le16(h + 20, 1);  // PCM
+    set_le16(h + 22, channel_count);
+    set_le32(h + 24, sample_rate_);
+    set_le32(h + 28, sample_rate_ * frame_size);
+    set_le16(h + 32, frame_size);
+    set_le16(h + 34, 8 * sizeof(sample_t));
+    memcpy(h + 36, "data", 4);
+    set_le32(h + 40, data_size);
+    if (fseek(file_, 0, SEEK_SET) || fwrite(h, sizeof(h), 1, file_) != 1)
+      err = "Couldn't write output file";
+  }
+
+  if (fclose(file_))
+    err = "Couldn't write output file";
+  file_ = nullptr;
+  return err;
+}
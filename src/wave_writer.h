@@ -0,0 +1,60 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WAVE_WRITER_H__
+#define __WAVE_WRITER_H__
+
+#include "common.h"
+#include "quantizer.h"
+#include <cstdio>
+#include <string>
+
+// Writes 16-bit stereo samples to a WAV file, or to a headerless raw PCM
+// file (little-endian) if requested. Float samples are quantized on the way
+// out, with the dither chosen.
+class Wave_Writer {
+public:
+  Wave_Writer();
+  ~Wave_Writer();
+
+  // Open output file. NULL on success, otherwise error string.
+  gme_err_t open(const std::string &path, long sample_rate, bool raw = false);
+
+  // Dither used when writing float samples (see Quantizer)
+  void set_dither(int mode) { quantizer_.set_dither(mode); }
+
+  // Write count samples (count / 2 stereo frames)
+  gme_err_t write(const sample_t *in, long count);
+  gme_err_t write(const float *in, long count);
+
+  // Finish WAV header and close file
+  gme_err_t close();
+
+  // Number of samples written so far
+  long sample_count() const { return sample_count_; }
+
+  // True if path has a raw PCM extension (.raw or .pcm)
+  static bool is_raw_path(const std::string &path);
+
+private:
+  FILE *file_;
+  long sample_rate_;
+  long sample_count_;
+  bool raw_;
+  Quantizer quantizer_;
+};
+
+#endif // __WAVE_WRITER_H__
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "work_queue.h"
+#include <thread>
+
+using namespace std;
+
+int Work_Queue::core_count() {
+  int n = thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+Work_Queue::Work_Queue(int workers) {
+  if (workers <= 0)
+    workers = core_count();
+  for (int i = 0; i < workers; i++)
+    queues_.emplace_back(new Queue);
+  next_ = 0;
+}
+
+void Work_Queue::push(job_t job) {
+  queues_[next_]->jobs.push_back(job);
+  next_ = (next_ + 1) % worker_count();
+}
+
+bool Work_Queue::take(int worker, job_t &job) {
+  // Own jobs first, then steal the biggest remaining job of another worker
+  for (int i = 0; i < worker_count(); i++) {
+    Queue &q = *queues_[(worker + i) % worker_count()];
+    lock_guard<mutex> lock(q.mutex);
+    if (!q.jobs.empty()) {
+      job = q.jobs.front();
+      q.jobs.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void Work_Queue::work(int worker) {
+  job_t job;
+  while (take(worker, job))
+    job(worker);
+}
+
+void Work_Queue::run() {
+  vector<thread> threads;
+  for (int i = 1; i < worker_count(); i++)
+    threads.emplace_back(&Work_Queue::work, this, i);
+
+  // Calling thread is worker 0
+  work(0);
+
+  for (auto &t : threads)
+    t.join();
+  next_ = 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2018 Damián Silvani
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WORK_QUEUE_H__
+#define __WORK_QUEUE_H__
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Runs a batch of jobs on a pool of worker threads. Each worker owns a deque
+// of jobs and, when it runs dry, steals from the other workers, so uneven
+// jobs still keep every core busy.
+class Work_Queue {
+public:
+  // Job function. Receives the index of the worker running it, so jobs can
+  // reuse per-worker state.
+  typedef std::function<void(int worker)> job_t;
+
+  // Create queue with given number of workers, or one per core if 0.
+  explicit Work_Queue(int workers = 0);
+
+  // Add job. Jobs are dealt to workers in order and taken from the front of
+  // each deque, so push the most expensive jobs first.
+  void push(job_t job);
+
+  // Run all pushed jobs and wait until they are finished
+  void run();
+
+  // Number of worker threads
+  int worker_count() const { return (int)queues_.size(); }
+
+  // Number of hardware threads, at least 1
+  static int core_count();
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<job_t> jobs;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  int next_;
+
+  bool take(int worker, job_t &job);
+  void work(int worker);
+};
+
+#endif // __WORK_QUEUE_H__